@@ -77,7 +77,6 @@ function private:resolveMethods(class, name_to_type)
       dub           = method.dub,
       is_set_attr   = method.is_set_attr,
       is_get_attr   = method.is_get_attr,
-      is_cast       = method.is_cast,
     }
     if method.ctor then
       opts.name = class.name
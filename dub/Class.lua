@@ -12,7 +12,6 @@ local lib = lub.class('dub.Class', {
   is_scope      = true,
   SET_ATTR_NAME = '_set_',
   GET_ATTR_NAME = '_get_',
-  CAST_NAME     = '_cast_',
   -- Can be overwritten by dub.cast parameter
   should_cast   = true,
 })
@@ -94,6 +93,18 @@ function lib:ignoreFunc(name)
   return self.ignore[name] or name == self.dub.push
 end
 
+-- Return the names of the methods adding and removing a reference on objects
+-- of this class (intrusive reference count) or nil. Both '@dub retain:' and
+-- '@dub release:' are needed and classes with a custom push are not
+-- reference counted.
+function lib:refCount()
+  local opts = self.dub
+  if not opts or opts.push or not opts.retain or not opts.release then
+    return nil
+  end
+  return opts.retain, opts.release
+end
+
 -- Set the class name and C++ object creation type.
 function lib:setName(name)
   if not name then
@@ -142,6 +153,13 @@ function lib:setOpt(opt)
     self.ignore[dtor] = true
   end
 
+  -- Reference count is only changed by the bindings.
+  for _, key in ipairs {'retain', 'release'} do
+    if self.dub[key] then
+      self.ignore[self.dub[key]] = true
+    end
+  end
+
   -- cast
   if self.dub.cast == false then
     self.should_cast = false
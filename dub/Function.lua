@@ -34,6 +34,12 @@ local private = {}
 function lib.new(def)
   local self = def
   self.dub = self.dub or {}
+  if self.dub.lstring then
+    private.mergeLenParams(self, 'lstring')
+  end
+  if self.dub.array then
+    private.mergeLenParams(self, 'array')
+  end
   self.member = self.parent.is_class and not (self.static or self.ctor)
   self.has_defaults = self.params_list.first_default and true
   self.header = self.header or self.parent.header
@@ -152,12 +158,19 @@ function lib:nameWithArgs()
   return self.definition .. self.argsstring
 end
 
+-- Exception specifications of functions that never throw (without spaces).
+local NEVER_THROWS = {
+  ['throw()']        = true,
+  ['noexcept']       = true,
+  ['noexcept(true)'] = true,
+}
+
 -- Returns true if the function does not throw any C++ exception.
 function lib:neverThrows()
-  return self.throw == 'throw ()' or
+  return (self.throw and NEVER_THROWS[string.gsub(self.throw, '%s', '')]) or
          self.is_set_attr or
          self.is_get_attr or
-         self.is_cast
+         false
 end
 
 -- Set function name and C name.
@@ -201,6 +214,40 @@ function private:paramsIterator()
   end
 end
 
+-- Merge (const char *data, size_t len) or (const T *ptr, size_t n) parameter
+-- pairs listed in the 'lstring' or 'array' setting (`key`) into a single
+-- parameter. The length parameter is removed and its name stored in the
+-- pointer parameter (`key` field).
+function private:mergeLenParams(key)
+  local names = self.dub[key]
+  if type(names) == 'string' then
+    names = {[names] = true}
+  end
+  local list = self.params_list
+  local res = {str = list.str}
+  local len_param
+  for i, param in ipairs(list) do
+    if param == len_param then
+      -- skip
+    else
+      table.insert(res, param)
+      param.position = #res
+      if names[param.name] then
+        len_param = list[i+1]
+        if len_param then
+          param[key] = len_param.name
+        else
+          dub.warn(1, "Missing length parameter for '%s' in %s.", param.name, self.name)
+        end
+      end
+      if param.default and not res.first_default then
+        res.first_default = param.position
+      end
+    end
+  end
+  self.params_list = res
+end
+
 -- Create a string identifying the met type for overloading. This is just
 -- a concatenation of param type names.
 function private.makeSignature(met)
@@ -18,13 +18,57 @@ local pairs, ipairs, format,        gsub,        insert,       sub,        len =
 -- We use this 'global' to avoid changing TYPE_TO_CHECK API (push, pull, cast).
 local LNAME = 'L'
 
+-- Converter for a sequence container (std::vector) of native types. Push
+-- creates a presized table and pull reserves the vector capacity. Both use
+-- raw table access. Attributes and references are pushed as proxies ('view').
+local function seqType(cpp_name)
+  return {
+    type   = 'table',
+    view   = 'seq',
+    pull   = function(name, position, prefix)
+      local check = prefix == 'luaL_' and 'dub::checkseq_n' or 'dub::checkseq'
+      return format('%s %s;\n%s('..LNAME..', %i, %s);', cpp_name, name, check, position, name)
+    end,
+    push   = function(name)
+      return format('dub::pushseq('..LNAME..', %s);', name)
+    end,
+    cast   = function(name)
+      return name
+    end,
+  }
+end
+
+-- Same as seqType for map containers (std::map, std::unordered_map).
+local function mapType(cpp_name)
+  return {
+    type   = 'table',
+    view   = 'map',
+    pull   = function(name, position, prefix)
+      local check = prefix == 'luaL_' and 'dub::checkmap_n' or 'dub::checkmap'
+      return format('%s %s;\n%s('..LNAME..', %i, %s);', cpp_name, name, check, position, name)
+    end,
+    push   = function(name)
+      return format('dub::pushmap('..LNAME..', %s);', name)
+    end,
+    cast   = function(name)
+      return name
+    end,
+  }
+end
+
+-- Element types of begin()/end() ranges (pushed with dub::pushelem).
+local RANGE_ELEM_TYPES = {
+  double        = true,
+  float         = true,
+  int           = true,
+  ['std::string'] = true,
+}
+
 local lib     = lub.class('dub.LuaBinder', {
   SELF = 'self',
   -- By default, we try to access userdata in field 'super'. This is not
   -- slower then checkudata if the element passed is a userdata.
   TYPE_ACCESSOR = 'checksdata',
-  -- By default does an strcmp to ensure correct attribute key.
-  ASSERT_ATTR_KEY = true,
   LUA_STACK_SIZE_NAME = 'LuaStackSize',
   CHECK_TO_NATIVE = {
     -- default is to use the same type (number = 'number')
@@ -75,6 +119,57 @@ local lib     = lub.class('dub.LuaBinder', {
         return format('std::string(%s, %s_sz_)', name, name)
       end,
     },
+    -- Points to the Lua string (no copy).
+    ['std::string_view'] = {
+      type   = 'string',
+      pull   = function(name, position, prefix)
+        return format('size_t %s_sz_;\nconst char *%s = %schecklstring('..LNAME..', %i, &%s_sz_);',
+                      name, name, prefix, position, name)
+      end,
+      push   = function(name)
+        return format('lua_pushlstring('..LNAME..', %s.data(), %s.size());', name, name)
+      end,
+      cast   = function(name)
+        return format('std::string_view(%s, %s_sz_)', name, name)
+      end,
+    },
+    ['std::vector< double >']      = seqType('std::vector< double >'),
+    ['std::vector< float >']       = seqType('std::vector< float >'),
+    ['std::vector< int >']         = seqType('std::vector< int >'),
+    ['std::vector< std::string >'] = seqType('std::vector< std::string >'),
+  },
+  -- (const char *data, size_t len) parameters passed as a single Lua string
+  -- ('@dub lstring: data').
+  LSTRING_TYPE = {
+    type   = 'string',
+    pull   = function(name, position, prefix)
+      return format('size_t %s_sz_;\nconst char *%s = %schecklstring('..LNAME..', %i, &%s_sz_);',
+                    name, name, prefix, position, name)
+    end,
+    push   = function(name)
+      return format('lua_pushlstring('..LNAME..', %s, %s_sz_);', name, name)
+    end,
+    cast   = function(name)
+      return format('%s, %s_sz_', name, name)
+    end,
+  },
+  -- (const T *ptr, size_t n) parameters passed as a single Lua table
+  -- ('@dub array: ptr'). The elements are copied in a std::vector.
+  ARRAY_TYPE = function(elem_name)
+    local seq = seqType(format('std::vector< %s >', elem_name))
+    return {
+      type   = 'table',
+      pull   = seq.pull,
+      push   = seq.push,
+      cast   = function(name)
+        return format('(%s.empty() ? NULL : &%s[0]), %s.size()', name, name, name)
+      end,
+    }
+  end,
+  -- Return values pushed as a dub::Buffer ('@dub buffer: size').
+  BUFFER_TYPE = {
+    type   = 'userdata',
+    buffer = true,
   },
   -- Native Lua operators
   LUA_NATIVE_OP = {
@@ -94,6 +189,7 @@ local lib     = lub.class('dub.LuaBinder', {
     number  = 'LUA_TNUMBER',
     boolean = 'LUA_TBOOLEAN',
     string  = 'LUA_TSTRING',
+    table   = 'LUA_TTABLE',
   },
   -- Relative path to copy dub headers and cpp files. Must be
   -- relative to the bindings output directory.
@@ -104,6 +200,16 @@ local lib     = lub.class('dub.LuaBinder', {
     unix   = '-O2 -fPIC -I/usr/include/lua'..string.match(_VERSION, ' (.*)$')..' -g -Wall -Wl,-headerpad_max_install_names -shared -lstdc++',
   }
 })
+-- Map containers of native types.
+for _, map in ipairs {'std::map', 'std::unordered_map'} do
+  for _, key in ipairs {'int', 'std::string'} do
+    for _, value in ipairs {'double', 'float', 'int', 'std::string'} do
+      local name = format('%s< %s, %s >', map, key, value)
+      lib.TYPE_TO_CHECK[name] = mapType(name)
+    end
+  end
+end
+
 lib.COMPILER_FLAGS.linux = lib.COMPILER_FLAGS.unix
 lib.COMPILER_FLAGS.win32 = lib.COMPILER_FLAGS.unix
 
@@ -142,6 +248,29 @@ end
 -- + (extra_headers):  List of extra header includes to add in generated C++ files.
 -- + (custom_bindings): Path to a directory containing yaml files with custom
 --                     bindings. Can also be a table. See [Custom Bindings](dub.html#Custom-bindings).
+-- + (index):          Set to 'lua' so that classes with public attributes find
+--                     their methods in the metatable before calling the C
+--                     __index function. Can be set per class with '@dub index: lua'.
+-- + (exceptions):     Set to false to generate bindings without try/catch
+--                     blocks. Bound C++ code must not throw.
+-- + (lazy_errors):    Raise dub::Error objects instead of strings. The error
+--                     message is only formatted when the error is converted
+--                     with tostring.
+-- + (identity):       Set to true so that pointers already known to Lua are
+--                     pushed as the same userdata. Can be set per class with
+--                     '@dub identity: true'.
+-- + (storage):        Set to 'inline' to build objects created by the
+--                     bindings inside the userdata (no separate allocation)
+--                     or 'shared' to hold them by a std::shared_ptr stored in
+--                     the userdata. Can be set per class with '@dub storage:
+--                     inline'.
+-- + (allocator):      Set to 'pool' to allocate objects created by the
+--                     constructors in a free-list pool (one per class and
+--                     lua_State). Can be set per class with '@dub allocator:
+--                     pool'.
+-- + (stats):          Set to true to record object statistics per class
+--                     (dub::ClassStats, '_stats_' class method). Can be set
+--                     per class with '@dub stats: true'.
 function lib:bind(inspector, options)
   private.parseOptions(self, options)
 
@@ -227,6 +356,17 @@ end
 -- + (extra_headers):  List of extra header includes to add in generated C++ files.
 -- + (custom_bindings): Path to a directory containing yaml files with custom
 --                     bindings. Can also be a table. See [Custom Bindings](dub.html#Custom-bindings).
+-- + (index):          Set to 'lua' so that classes with public attributes find
+--                     their methods in the metatable before calling the C
+--                     __index function. Can be set per class with '@dub index: lua'.
+-- + (exceptions):     Set to false to generate bindings without try/catch
+--                     blocks. Bound C++ code must not throw.
+-- + (lazy_errors):    Raise dub::Error objects instead of strings.
+-- + (identity):       Push pointers already known to Lua as the same userdata.
+-- + (storage):        Set to 'inline' to build objects inside the userdata or
+--                     'shared' to hold them by a std::shared_ptr.
+-- + (allocator):      Set to 'pool' to allocate objects in a per class pool.
+-- + (stats):          Set to true to record object statistics per class.
 function lib:bindClass(class, options)
   private.parseOptions(self, options)
 
@@ -235,7 +375,14 @@ function lib:bindClass(class, options)
     -- path to current file
     self.class_template = lub.Template {path = lub.path('|assets/lua/class.cpp')}
   end
-  return self.class_template:run {dub = dub, class = class, self = self}
+  -- The class metatable is always the first type (dub_types[0]). It holds
+  -- the casts to the super classes.
+  self.types = nil
+  self.keys = nil
+  self:typeRef(self:libName(class))
+  self.types.cast_class = class
+  local res = self.class_template:run {dub = dub, class = class, self = self}
+  return private.declareTypes(self, res)
 end
 
 function lib:addCustomTypes(list)
@@ -291,20 +438,49 @@ function lib:functionBody(parent, method)
   self:resolveTypes(method)
   local custom = private.customMetBinding(self, parent, method)
   local res = ''
+  -- Bindings without try/catch must only use helpers calling lua_error.
+  self.no_throw = self:neverThrows(method)
 
   if method.dtor then
-    res = res .. format('DubUserdata *userdata = ((DubUserdata*)dub::checksdata_d('..self.L..', 1, "%s"));\n', self:libName(parent))
+    local accessor = self.no_throw and 'dub::checksdata_dn' or 'dub::checksdata_d'
+    res = res .. format('DubUserdata *userdata = %s('..self.L..', 1, %s);\n', accessor, self:typeRef(self:libName(parent)))
     if custom and custom.body then
       res = res .. custom.body
     else
-      res = res .. 'if (userdata->gc) {\n'
+      if self:gcSize(parent) then
+        -- Also when the object was deleted from C++.
+        res = res .. format('dub::gcaccount(%s, userdata, 0);\n', self.L)
+      end
+      if self:classStats(parent) then
+        res = res .. 'dub_stats.remove(userdata);\n'
+      end
+      -- Objects held by a std::shared_ptr are released, not deleted.
+      res = res .. 'if (userdata->shared) {\n'
+      res = res .. '  dub::releaseshared(userdata);\n'
+      res = res .. '} else if (userdata->gc) {\n'
       res = res .. format('  %sself = (%s)userdata->ptr;\n', parent.create_name, parent.create_name)
       if custom and custom.cleanup then
         res = res .. '  ' .. gsub(custom.cleanup, '\n', '\n  ')
       end
-      local dtor = parent.dub.destructor or method.parent.dub.destructor
+      local _, release = self:refCount(parent)
+      local dtor = release or parent.dub.destructor or method.parent.dub.destructor
       if dtor then
         res = res .. format('  self->%s();\n', dtor)
+      elseif self:inlineStorage(parent) then
+        -- Objects built in the userdata are destroyed in place.
+        res = res .. format('  if (dub::isinline<%s>(userdata)) {\n', string.sub(parent.create_name, 1, -3))
+        res = res .. format('    self->~%s();\n', parent.name)
+        res = res .. '  } else {\n'
+        res = res .. '    delete self;\n'
+        res = res .. '  }\n'
+      elseif self:poolAllocator(parent) then
+        -- Objects created by the constructors go back to the pool.
+        res = res .. '  if (userdata->pooled) {\n'
+        res = res .. format('    self->~%s();\n', parent.name)
+        res = res .. '    dub_pool.get('..self.L..').free(self);\n'
+        res = res .. '  } else {\n'
+        res = res .. '    delete self;\n'
+        res = res .. '  }\n'
       else
         res = res .. '  delete self;\n'
       end
@@ -316,7 +492,9 @@ function lib:functionBody(parent, method)
     local param_delta = 0
     if method.member then
       -- We need self
-      res = res .. private.getSelf(self, parent, method, method.is_get_attr)
+      -- With a Lua __index, the C function is only called for attributes.
+      local need_mt = method.is_get_attr and not self:luaIndex(parent)
+      res = res .. private.getSelf(self, parent, method, need_mt)
       param_delta = 1
     end
     if method.has_defaults then
@@ -327,8 +505,6 @@ function lib:functionBody(parent, method)
       res = res .. private.switch(self, parent, method, param_delta, private.setAttrBody, parent.attributes)
     elseif method.is_get_attr then
       res = res .. private.switch(self, parent, method, param_delta, private.getAttrBody, parent.attributes)
-    elseif method.is_cast then
-      res = res .. private.switch(self, parent, method, param_delta, private.castBody, parent.superclasses)
     elseif method.overloaded then
       local tree, need_top = self:decisionTree(method.overloaded)
       if need_top then
@@ -354,6 +530,7 @@ function lib:functionBody(parent, method)
       res = res .. private.callWithParams(self, parent, method, param_delta, '', custom and custom.body)
     end
   end
+  self.no_throw = nil
   return res
 end
 
@@ -373,6 +550,12 @@ function private:callWithParams(class, method, param_delta, indent, custom, max_
     if not string.match(custom, 'return[ ]+[^ ]') then
       res = res .. '\nreturn 0;'
     end
+  elseif method.array_op then
+    -- Bulk C array attribute access.
+    res = res .. private.arrayOp(self, class, method)
+  elseif method.op_variant then
+    -- Arithmetic operator writing in an existing object.
+    res = res .. private.opVariant(self, class, method)
   else
     if method.array_get or method.array_set then
       local i_name = method.params_list[1].name
@@ -392,12 +575,78 @@ function private:callWithParams(class, method, param_delta, indent, custom, max_
   return gsub(res, '\n', '\n' .. indent)
 end
 
+-- dub runtime functions for bulk C array attribute access.
+local ARRAY_OP_FUNC = {
+  slice    = 'dub::readarray',
+  setslice = 'dub::writearray',
+  fill     = 'dub::fillarray',
+}
+
+function private:arrayOp(class, method)
+  local name, dim = method.array_attr, method.array_dim
+  local func = ARRAY_OP_FUNC[method.array_op]
+  if func then
+    return format('return %s('..self.L..', self->%s, %s, 2);', func, name, dim)
+  elseif method.array_op == 'buffer' then
+    -- Zero-copy view on the array.
+    local res = format('dub::pushbuffer('..self.L..', self->%s, %s);\n', name, dim)
+    res = res .. 'dub::protect('..self.L..', lua_gettop('..self.L..'), 1, "_");\n'
+    return res .. 'return 1;'
+  end
+  -- copy from other object
+  local res = format('%sother = (%s)%s('..self.L..', 2, %s);\n',
+    class.create_name, class.create_name, self:customTypeAccessor(method), self:typeRef(self:libName(class)))
+  res = res .. format('for (size_t i = 0; i < %s; ++i) {\n', dim)
+  res = res .. format('  self->%s[i] = other->%s[i];\n', name, name)
+  res = res .. '}\n'
+  res = res .. 'return 0;'
+  return res
+end
+
+-- Body of name_into(v, out) and name_assign(v) (see
+-- dub.MemoryStorage.makeOpVariants). Uses the class 'operator+=' (or similar)
+-- when it accepts the same parameter type.
+function private:opVariant(class, method)
+  local op = method.op_method
+  local arg = private.paramForCall(self, method.params_list[1])
+  local res
+  if method.op_variant == 'into' then
+    res = format('%s = self->%s(%s);\n', private.paramForCall(self, method.params_list[2]), op.name, arg)
+    -- return out
+    res = res .. 'lua_pushvalue('..self.L..', 3);\n'
+  else
+    local assign = class:method(op.name .. '=')
+    local sign = op.params_list[1].ctype.name
+    for _, m in ipairs(assign and (assign.overloaded or {assign}) or {}) do
+      if #m.params_list == 1 and private.sameType(class, m.params_list[1].ctype.name, sign) then
+        res = format('self->%s(%s);\n', m.name, arg)
+        break
+      end
+    end
+    res = res or format('*self = self->%s(%s);\n', op.name, arg)
+    -- return self
+    res = res .. 'lua_pushvalue('..self.L..', 1);\n'
+  end
+  return res .. 'return 1;'
+end
+
+-- Return true if the type names `a` and `b` are the same type in the scope
+-- of `class` (namespace prefix, typedef).
+function private.sameType(class, a, b)
+  if a == b then
+    return true
+  end
+  local t = class.db:resolveType(class, a)
+  return t and t == class.db:resolveType(class, b) or false
+end
+
 function private:detectType(pos, type_name)
   local k = self.NATIVE_TO_TLUA[type_name]
   if k then
     return format('type__ == %s', k), false
   else
-    return format('dub::issdata('..self.L..', %i, "%s", type__)', pos, type_name), true
+    local accessor = self.no_throw and 'dub::issdata_n' or 'dub::issdata'
+    return format('%s('..self.L..', %i, %s, type__)', accessor, pos, self:typeRef(type_name)), true
   end
 end
 
@@ -441,7 +690,7 @@ function private:expandTreeByType(tree, class, param_delta, indent, max_arg)
       local ptr_name = format('ptr%i__', param_delta + pos)
       if not ptr_for_pos[param_delta + pos] then
         ptr_for_pos[param_delta + pos] = ptr_name
-        res = res .. format('void **%s;\n', ptr_name)
+        res = res .. format('void *%s;\n', ptr_name)
       end
 
       -- This ensures that we only use the ptr if there was a dub::issdata clause
@@ -625,8 +874,54 @@ function lib:header(header)
   return header
 end
 
+-- Return the expression used in the generated file to access the dub::Type
+-- of metatable `mt_name`. Types are collected while generating a file and
+-- declared in a 'dub_types' array at the top of the file. Each file resolves
+-- its types to metatables once per lua_State when it is opened. The optional
+-- `methods` is the C++ expression of the metamethods of a metatable private
+-- to the file (container views).
+function lib:typeRef(mt_name, methods)
+  local types = self.types
+  if not types then
+    types = {list = {}, index = {}, methods = {}}
+    self.types = types
+  end
+  local idx = types.index[mt_name]
+  if not idx then
+    insert(types.list, mt_name)
+    idx = #types.list
+    types.index[mt_name] = idx
+    types.methods[mt_name] = methods
+  end
+  return format('dub_types[%i]', idx - 1)
+end
+
+-- Return the index of attribute key `name` in the 'dub_keys' list declared at
+-- the top of the class file. Attribute access dispatches on this index
+-- (interned in a Lua table, see dub::keyindex).
+function lib:keyRef(name)
+  local keys = self.keys
+  if not keys then
+    keys = {list = {}, index = {}}
+    self.keys = keys
+  end
+  local idx = keys.index[name]
+  if not idx then
+    insert(keys.list, name)
+    idx = #keys.list
+    keys.index[name] = idx
+  end
+  return idx
+end
+
+-- Return the class id used in type checks for metatable `mt_name` (32 bit
+-- sdbm hash, see dub::Type).
+function lib:typeId(mt_name)
+  return dub.hash(mt_name, 4294967296)
+end
+
 function lib:customTypeAccessor(method)
-  if method:neverThrows() then
+  if self.no_throw or self:neverThrows(method) then
     return 'dub::checksdata_n'
   else
     return private.checkPrefix(self, method) .. self.TYPE_ACCESSOR
@@ -655,6 +950,145 @@ function lib:openName(elem)
   end
 end
 
+-- Return true if the binding for `method` does not catch C++ exceptions. This
+-- is the case for methods declared with 'throw ()' or 'noexcept' and for all
+-- methods when the 'exceptions' option is set to false. These bindings use
+-- luaL_check... and dub helpers that report errors with lua_error.
+function lib:neverThrows(method)
+  return self.options.exceptions == false or method:neverThrows()
+end
+
+-- Return true if pointers to objects of `class` should be pushed with the
+-- identity cache (same userdata for the same pointer). Set with the
+-- 'identity' option or per class with '@dub identity: true'.
+function lib:identity(class)
+  if not class.dub then return false end
+  local identity = class.dub.identity
+  if identity == nil then
+    identity = self.options.identity
+  end
+  return identity and true or false
+end
+
+-- Return true if objects of `class` created by the bindings (constructors
+-- and return by value) are built inside the userdata instead of being
+-- allocated with new. Set with the 'storage' option or per class with
+-- '@dub storage: inline'. Classes with a custom push, destructor, destroy
+-- setting or a reference count keep heap storage.
+function lib:inlineStorage(class)
+  local opts = class.dub
+  if not opts or class.abstract or opts.push or opts.destructor or opts.destroy or
+     self:refCount(class) then
+    return false
+  end
+  return (opts.storage or self.options.storage) == 'inline'
+end
+
+-- Return true if objects of `class` created by the bindings (constructors
+-- and return by value) are built with std::make_shared and pushed with the
+-- std::shared_ptr stored in the userdata (needs C++11). Set with the
+-- 'storage' option or per class with '@dub storage: shared'. Classes with a
+-- custom push, destructor, destroy setting or a reference count keep heap
+-- storage.
+function lib:sharedStorage(class)
+  local opts = class.dub
+  if not opts or class.abstract or opts.push or opts.destructor or opts.destroy or
+     self:refCount(class) then
+    return false
+  end
+  return (opts.storage or self.options.storage) == 'shared'
+end
+
+-- Return true if objects of `class` created by the constructors are
+-- allocated in the pools (one per lua_State) of a dub::ClassPool declared in
+-- the class bindings. Set with the 'allocator' option or per class with
+-- '@dub allocator: pool'. Classes with inline storage, a custom push
+-- (dub::Object can be deleted from C++), destructor, destroy setting or a
+-- reference count do not use the pool.
+function lib:poolAllocator(class)
+  local opts = class.dub
+  if not opts or class.abstract or opts.push or opts.destructor or opts.destroy or
+     self:refCount(class) then
+    return false
+  end
+  if self:inlineStorage(class) or self:sharedStorage(class) then return false end
+  return (opts.allocator or self.options.allocator) == 'pool'
+end
+
+-- Return the names of the methods adding and removing a reference on objects
+-- of `class` (intrusive reference count) or nil. Set per class with '@dub
+-- retain:' and '@dub release:'. Each userdata then holds a reference: the
+-- bindings retain pointers to existing objects instead of keeping their
+-- owner alive with dub::protect and __gc calls release instead of delete.
+function lib:refCount(class)
+  return dub.Class.refCount(class)
+end
+
+-- Return true if the bindings of `class` record object statistics in a
+-- dub::ClassStats declared in the class bindings. Set with the 'stats'
+-- option or per class with '@dub stats: true'.
+function lib:classStats(class)
+  local opts = class.dub
+  if not opts or class.abstract then
+    return false
+  end
+  local stats = opts.stats
+  if stats == nil then
+    stats = self.options.stats
+  end
+  return stats and true or false
+end
+
+-- Return the C++ expression giving the native memory (in bytes) held by an
+-- object of `class` ('self' is the object) or nil. Set with '@dub gc_size:'
+-- followed by a method name, a number of bytes or an expression using
+-- 'self'.
+function lib:gcSize(class)
+  local size = class.dub and class.dub.gc_size
+  if not size then
+    return nil
+  elseif type(size) == 'number' then
+    return tostring(size)
+  elseif class:method(size) then
+    return format('self->%s()', size)
+  end
+  return size
+end
+
+-- Return how objects of `class` are iterated by the generated iter() and
+-- __pairs methods: 'range' for begin()/end() iterators on native elements,
+-- 'index' for size() with an integer operator[] and nil if the class is not
+-- iterable or has its own iter method. Disable with '@dub iter: false'.
+function lib:iterable(class)
+  local opts = class.dub
+  if not opts or opts.iter == false or class:method('iter') or class:method('__pairs') then
+    return nil
+  end
+  local range = class.iter_range
+  if range and range.begin and range['end'] then
+    local ctype = range.begin.return_value
+    local elem = ctype.ptr and ctype.name or string.match(ctype.name, '< (.-) >::[%w_]*iterator$')
+    if RANGE_ELEM_TYPES[elem] then
+      return 'range'
+    end
+  end
+  local get = class:method(class.GET_ATTR_NAME)
+  local size = class:method('size')
+  local op = get and get.index_op
+  if op and size and #size.params_list == 0 and
+     self.TYPE_TO_CHECK[op.params_list[1].ctype.name] == 'integer' then
+    return 'index'
+  end
+end
+
+-- Return true if methods of the class should be found with a plain table
+-- lookup before calling the C __index function for attributes (see
+-- dub::luaindex).
+function lib:luaIndex(class)
+  local mode = class.dub.index or self.options.index
+  return mode == 'lua' and class:method(class.GET_ATTR_NAME) ~= nil
+end
+
 -- Return the 'public' name to use for a constant. Instead of rewriting this
 -- method, users can also use the 'const_name_filter' option.
 function lib:constName(name, enum)
@@ -699,7 +1133,18 @@ function lib:libName(elem)
 end
 
 function lib:luaType(parent, ctype)
-  local rtype = parent.db:resolveType(parent, ctype.name)
+  local elem = string.match(ctype.name, '^std::shared_ptr< (.+) >$')
+  local rtype = elem and parent.db:resolveType(parent, elem)
+  if rtype and rtype.type == 'dub.Class' then
+    -- userdata holding a std::shared_ptr
+    return {
+      type    = 'userdata',
+      rtype   = rtype,
+      mt_name = self:libName(rtype),
+      shared  = true,
+    }
+  end
+  rtype = parent.db:resolveType(parent, ctype.name)
 
   if rtype and rtype.type == 'dub.Class' then
     -- userdata
@@ -787,12 +1232,43 @@ function lib:toStringBody(class)
   return res
 end
 
+-- Body of the iter() method (also used for __pairs). Index iteration is
+-- stateless (the object and the last index), ranges keep the cursor in a
+-- single userdata.
+function lib:iterBody(class)
+  local res = ''
+  local check = format('dub::checksdata_n('..self.L..', 1, %s)', self:typeRef(self:libName(class)))
+  if self:iterable(class) == 'range' then
+    res = res .. format('%s%s = (%s)%s;\n', class.create_name, self.SELF, class.create_name, check)
+    res = res .. 'dub::pushrange('..self.L..', self->begin(), self->end());\n'
+    res = res .. '// The cursor keeps self alive.\n'
+    res = res .. 'dub::protect('..self.L..', lua_gettop('..self.L..') - 1, 1, "_");\n'
+  else
+    res = res .. check .. ';\n'
+    res = res .. format('lua_pushcfunction('..self.L..', %s__iter_next);\n', class.name)
+    res = res .. 'lua_pushvalue('..self.L..', 1);\n'
+    res = res .. 'lua_pushnil('..self.L..');\n'
+  end
+  return res .. 'return 3;'
+end
+
+-- Iterator function for index iteration: push the next index (from 1 to
+-- size() like ranges) and the value of operator[] (from 0 to size() - 1).
+function lib:iterNextBody(class)
+  local op = class:method(class.GET_ATTR_NAME).index_op
+  self:resolveTypes(op)
+  local res = private.getSelf(self, class, dummy_to_string_method, false)
+  res = res .. 'lua_Integer i = lua_isnil('..self.L..', 2) ? 1 : lua_tointeger('..self.L..', 2) + 1;\n'
+  res = res .. 'if (i > (lua_Integer)self->size()) return 0;\n'
+  res = res .. 'lua_pushinteger('..self.L..', i);\n'
+  return res .. private.pushValue(self, op, 'self->operator[](i - 1)', op.return_value, nil, 2)
+end
+
 --=============================================== PRIVATE
 
 -- if this method does never throw, we can use luaL_check...
 function private:checkPrefix(method)
-  if self.options.exceptions == false or
-     method:neverThrows() then
+  if self.no_throw or self:neverThrows(method) then
     return 'luaL_'
   else
     return 'dub::'
@@ -803,14 +1279,14 @@ end
 -- 'super'.
 function private.getSelf(self, class, method, need_mt)
   local nmt
-  local fmt = '%s%s = *((%s*)%s('..self.L..', 1, "%s"%s));\n'
+  local fmt = '%s%s = (%s)%s('..self.L..', 1, %s%s);\n'
   if need_mt then
     -- Type accessor should leave metatable on stack.
     nmt = ', true'
   else
     nmt = ''
   end
-  return format(fmt, class.create_name or class.name, self.SELF, class.create_name or class.name, self:customTypeAccessor(method), self:libName(class), nmt)
+  return format(fmt, class.create_name or class.name, self.SELF, class.create_name or class.name, self:customTypeAccessor(method), self:typeRef(self:libName(class)), nmt)
 end
 
 --- Prepare a variable with a function parameter.
@@ -828,6 +1304,8 @@ function private:getParamVar(method, param, delta)
   if lua.push then
     -- special push/pull type
     return p .. '\n'
+  elseif lua.shared then
+    return format('std::shared_ptr<%s> %s = %s;\n', string.sub(rtype.create_name, 1, -3), param.name, p)
   else
     -- native type
     return format('%s%s = %s;\n', rtype.create_name, param.name, p)
@@ -855,7 +1333,13 @@ function lib:resolveTypes(base)
       if i > 1 then
         sign = sign .. ', '
       end
-      param.lua = self:luaType(parent, param.ctype)
+      if param.lstring then
+        param.lua = self.LSTRING_TYPE
+      elseif param.array then
+        param.lua = self.ARRAY_TYPE(param.ctype.name)
+      else
+        param.lua = self:luaType(parent, param.ctype)
+      end
       if param.lua.type == 'userdata' then
         sign = sign .. param.lua.rtype.name
       else
@@ -863,7 +1347,11 @@ function lib:resolveTypes(base)
       end
     end
     if method.return_value then
-      method.return_value.lua = self:luaType(parent, method.return_value)
+      if method.dub and method.dub.buffer then
+        method.return_value.lua = self.BUFFER_TYPE
+      else
+        method.return_value.lua = self:luaType(parent, method.return_value)
+      end
     end
     method.lua_signature = sign
   end
@@ -875,20 +1363,25 @@ function private:getParam(method, param, delta)
   local ctype = param.ctype
   -- Resolved ctype
   local rtype = lua.rtype
-  if lua.mt_name and method.ptr_for_pos then
+  if lua.mt_name and method.ptr_for_pos and not lua.shared then
     local ptr = method.ptr_for_pos[format('%s-%i', lua.mt_name, delta + param.position)]
     if ptr then
       -- Only use ptr once (the first entry
-      return format('*((%s*)%s)',
+      return format('((%s)%s)',
         rtype.create_name, ptr)
     end
   end
   
-  if lua.type == 'userdata' then
+  if lua.shared then
+    -- std::shared_ptr sharing the ownership of the userdata
+    local accessor = string.gsub(self:customTypeAccessor(method), 'checksdata', 'checkshared')
+    return format('%s<%s>('..self.L..', %i, %s)',
+      accessor, string.sub(rtype.create_name, 1, -3), param.position + delta, self:typeRef(lua.mt_name))
+  elseif lua.type == 'userdata' then
     -- userdata
     type_method = self:customTypeAccessor(method)
-    return format('*((%s*)%s('..self.L..', %i, "%s"))',
-      rtype.create_name, type_method, param.position + delta, lua.mt_name)
+    return format('((%s)%s('..self.L..', %i, %s))',
+      rtype.create_name, type_method, param.position + delta, self:typeRef(lua.mt_name))
   else
     -- native lua type
     local prefix = private.checkPrefix(self, method)
@@ -913,7 +1406,7 @@ function private:paramForCall(param)
     res = res .. lua.cast(param.name)
   elseif lua.type == 'userdata' then
     -- custom type
-    if param.ctype.ptr then
+    if param.ctype.ptr or lua.shared then
       res = res .. param.name
     else
       res = res .. '*' .. param.name
@@ -954,7 +1447,11 @@ function private:doCall(parent, method, max_arg)
     res = res .. ')'
   end
   if method.ctor then
-    res = 'new ' .. res
+    if self:poolAllocator(parent) then
+      res = 'new(dub_pool.get('..self.L..')) ' .. res
+    else
+      res = 'new ' .. res
+    end
   elseif method.member then
     res = self.SELF .. '->' .. res
   elseif parent.is_scope then
@@ -971,7 +1468,7 @@ function private:pushReturnValue(class, method, value)
     if return_value.name == self.LUA_STACK_SIZE_NAME then
       res = res .. 'return ' .. value .. ';'
     else
-      res = res .. private.pushValue(self, method, value, return_value)
+      res = res .. private.pushValue(self, method, value, return_value, class)
     end
   else
     res = res .. value .. ';\n'
@@ -980,63 +1477,136 @@ function private:pushReturnValue(class, method, value)
   return res
 end
 
-function private:pushValue(method, value, return_value)
+-- Push `value` (C++ expression of type `return_value`) and return `nret`
+-- values (1 by default). Objects owned by Lua are counted in the statistics
+-- of `class` if it is the type of the object (see private:pushHooks).
+function private:pushValue(method, value, return_value, class, nret)
+  local res, obj = private.pushObject(self, method, value, return_value)
+  if string.match(res, '^return ') then
+    return res
+  end
+  if obj then
+    res = res .. private.pushHooks(self, method, return_value, obj, class)
+  end
+  return res .. format('\nreturn %i;', nret or 1)
+end
+
+-- Code run after pushing an object described by `obj` (see
+-- private:pushObject): mark memory allocated in the class pool, report the
+-- native memory of new objects and count objects owned by Lua.
+function private:pushHooks(method, return_value, obj, class)
+  local res = ''
+  if obj.pooled then
+    -- Memory goes back to the pool on __gc.
+    res = res .. '\n((DubUserdata*)lua_touserdata('..self.L..', -1))->pooled = true;'
+  end
+  if method.ctor and obj.ptr and self:gcSize(method.parent) then
+    -- Report native memory held by the new object.
+    res = res .. format('\ndub::gcaccount('..self.L..', -1, dub_gcsize(%s));', obj.ptr)
+  end
+  if obj.owned and class and return_value.lua.rtype == class and self:classStats(class) then
+    res = res .. '\ndub_stats.add('..self.L..', -1);'
+  end
+  return res
+end
+
+-- Return the code pushing `value` (without return statement) and, for
+-- userdata, a table describing the pushed object: 'owned' is true if the
+-- userdata owns the object (deleted or released on __gc), 'ptr' is the C++
+-- expression of the object pointer for new objects and 'pooled' is true if
+-- the object was allocated in the class pool.
+function private:pushObject(method, value, return_value)
   local res
+  local obj
   local lua = return_value.lua
   local ctype = return_value
-  if lua.push then
+  if lua.buffer then
+    -- Zero-copy view on the returned memory.
+    res = private.pushBuffer(self, method, value, ctype)
+  elseif lua.view and not ctype.ptr and (method.is_get_attr or ctype.ref) then
+    -- Proxy to the live container.
+    res = private.pushView(self, method, value, ctype)
+  elseif lua.push then
     LNAME = self.L
     res = lua.push(value)
+  elseif lua.shared then
+    res = format('dub::pushshared('..self.L..', %s, %s);', value, self:typeRef(lua.mt_name))
+    obj = {owned = true}
   elseif lua.type == 'userdata' then
     -- resolved value
     local rtype = lua.rtype
     local gc
+    local type_ref = self:typeRef(lua.mt_name)
+    -- Push method for pointers and references to existing objects.
+    local push_ref = self:identity(rtype) and 'dub::pushcached' or 'dub::pushudata'
 
     if not ctype.ptr then
       -- Call return value is not a pointer. This should never happen with
       -- a type that uses a custom push method.
       assert(not rtype.dub or not rtype.dub.push,
         format("Types with @dub 'push' setting should not be passed as values (%s).", method:fullname()))
+      obj = {owned = false}
       if method.is_get_attr then
         if ctype.const then
           if self.options.read_const_member == 'copy' then
             -- copy
-            res = format('dub::pushudata('..self.L..', new %s(%s), "%s", true);', rtype.name, value, lua.mt_name)
+            res = format('dub::pushudata('..self.L..', new %s(%s), %s, true);', rtype.name, value, type_ref)
+            obj.owned = true
           else
             -- cast
-            res = format('dub::pushudata('..self.L..', const_cast<%s*>(&%s), "%s", false);', rtype.name, value, lua.mt_name)
+            res = format('%s('..self.L..', const_cast<%s*>(&%s), %s, false);', push_ref, rtype.name, value, type_ref)
           end
         else
-          res = format('dub::pushudata('..self.L..', &%s, "%s", false);', value, lua.mt_name)
+          res = format('%s('..self.L..', &%s, %s, false);', push_ref, value, type_ref)
         end
       elseif return_value.ref then
         -- Return value is a reference.
         if ctype.const then
           if self.options.read_const_member == 'copy' then
             -- copy
-            res = format('dub::pushudata('..self.L..', new %s(%s), "%s", true);', rtype.name, value, lua.mt_name)
+            res = format('dub::pushudata('..self.L..', new %s(%s), %s, true);', rtype.name, value, type_ref)
+            obj.owned = true
           else
             -- cast
-            res = format('dub::pushudata('..self.L..', const_cast<%s*>(&%s), "%s", false);', rtype.name, value, lua.mt_name)
+            res = format('%s('..self.L..', const_cast<%s*>(&%s), %s, false);', push_ref, rtype.name, value, type_ref)
           end
         else
           -- not const ref
-          res = format('dub::pushudata('..self.L..', &%s, "%s", false);', value, lua.mt_name)
+          res = format('%s('..self.L..', &%s, %s, false);', push_ref, value, type_ref)
         end
       else
         -- Return by value.
         if method.parent.dub and method.parent.dub.destroy == 'free' then
-          res = format('dub::pushfulldata<%s>('..self.L..', %s, "%s");', rtype.name, value, lua.mt_name)
+          res = format('dub::pushfulldata<%s>('..self.L..', %s, %s);', rtype.name, value, type_ref)
+        elseif self:inlineStorage(rtype) then
+          -- Copy in the userdata.
+          res, obj = private.newInline(self, rtype, type_ref, format('(%s)', value))
+        elseif self:sharedStorage(rtype) then
+          -- Copy held by a std::shared_ptr.
+          res, obj = private.newShared(self, rtype, type_ref, format('(%s)', value))
         else
           -- Allocate on the heap.
-          res = format('dub::pushudata('..self.L..', new %s(%s), "%s", true);', rtype.name, value, lua.mt_name)
+          res = format('dub::pushudata('..self.L..', new %s(%s), %s, true);', rtype.name, value, type_ref)
+          obj.owned = true
         end
       end
+    elseif method.ctor and self:inlineStorage(rtype) and string.match(value, '^new ') then
+      -- Construct in the userdata.
+      res, obj = private.newInline(self, rtype, type_ref, string.match(value, '^new [^(]+(%(.*%))$'))
+    elseif method.ctor and self:sharedStorage(rtype) and string.match(value, '^new ') then
+      -- Construct with std::make_shared.
+      res, obj = private.newShared(self, rtype, type_ref, string.match(value, '^new [^(]+(%(.*%))$'))
     else
       -- Return value is a pointer.
-      res = format('%s%sretval__ = %s;\n', 
-        (ctype.const and 'const ') or '',
-        rtype.create_name, value)
+      local retain = self:refCount(rtype)
+      if retain and ctype.const then
+        -- The userdata holds a reference on the object (never copied).
+        res = format('%sretval__ = const_cast<%s>(%s);\n', rtype.create_name, rtype.create_name, value)
+      else
+        res = format('%s%sretval__ = %s;\n', 
+          (ctype.const and 'const ') or '',
+          rtype.create_name, value)
+      end
       if not method.ctor then
         res = res .. 'if (!retval__) return 0;\n'
       end
@@ -1045,28 +1615,43 @@ function private:pushValue(method, value, return_value)
       if push_method then
         custom_push = true
         push_method = 'retval__->'.. push_method
+        -- Custom push methods receive the metatable name.
+        type_ref = format('"%s"', lua.mt_name)
       else
-        push_method = 'dub::pushudata'
+        push_method = push_ref
       end
-      if ctype.const then
+      obj = {owned = false, ptr = 'retval__'}
+      if retain then
+        -- New objects come with a reference. Other pointers are retained
+        -- instead of protecting the owner from garbage collection.
+        if not method.ctor and not (method.dub and method.dub.gc) then
+          res = res .. format('retval__->%s();\n', retain)
+        end
+        res = res .. format('%s('..self.L..', retval__, %s, true);', push_method, type_ref)
+        obj.owned = true
+      elseif ctype.const then
         assert(not custom_push, format("Types with @dub 'push' setting should not be passed as const types (%s).", method:fullname()))
         if self.options.read_const_member == 'copy' then
           -- copy
-          res = res .. format('%s('..self.L..', new %s(*retval__), "%s", true);',
-                              push_method, rtype.name, lua.mt_name)
+          res = res .. format('%s('..self.L..', new %s(*retval__), %s, true);',
+                              push_method, rtype.name, type_ref)
+          obj = {owned = true}
         else
           -- cast
-          res = res .. format('%s('..self.L..', const_cast<%s*>(retval__), "%s", false);',
-                              push_method, rtype.name, lua.mt_name)
+          res = res .. format('%s('..self.L..', const_cast<%s*>(retval__), %s, false);',
+                              push_method, rtype.name, type_ref)
         end
       else
         -- We should only GC in constructor.
         if method.ctor or (method.dub and method.dub.gc) then
-          res = res .. format('%s('..self.L..', retval__, "%s", true);',
-                              push_method, lua.mt_name)
+          res = res .. format('%s('..self.L..', retval__, %s, true);',
+                              push_method, type_ref)
+          obj.owned = true
+          -- Same decision as private:doCall.
+          obj.pooled = method.ctor and self:poolAllocator(method.parent)
         else
-          res = res .. format('%s('..self.L..', retval__, "%s", false);',
-                              push_method, lua.mt_name)
+          res = res .. format('%s('..self.L..', retval__, %s, false);',
+                              push_method, type_ref)
         end
       end
     end
@@ -1074,11 +1659,72 @@ function private:pushValue(method, value, return_value)
     -- native type
     res = format('lua_push%s('..self.L..', %s);', lua.type, value)
   end
-  if string.match(res, '^return ') then
-    return res
+  return res, obj
+end
+
+-- Push a proxy userdata to the container `value` (attribute or returned
+-- reference). The proxy keeps the object at index 1 alive. The proxy
+-- metatable is private to the binding file (created when the library is
+-- opened from the view metamethods).
+function private:pushView(method, value, ctype)
+  local lua = ctype.lua
+  local view = format('%sView', lua.view == 'seq' and 'Seq' or 'Map')
+  local mt_name = format('%s.%s<%s>', self:libName(method.parent), view, ctype.name)
+  local methods = format('dub::%s< %s >::rw', view, ctype.name)
+  local const = ''
+  if ctype.const then
+    mt_name = mt_name .. ' const'
+    methods = format('dub::%s< %s >::ro', view, ctype.name)
+    const = 'const '
+  end
+  local res = format('dub::pushview('..self.L..', (%s%s*)&%s, %s);', const, ctype.name, value, self:typeRef(mt_name, methods))
+  if method.member or method.is_get_attr then
+    res = res .. '\ndub::protect('..self.L..', lua_gettop('..self.L..'), 1, "_");'
+  end
+  return res
+end
+
+-- Push a dub::Buffer on the memory returned by a method with '@dub buffer:
+-- size'. Pointers use the `size` method for the number of elements, vector
+-- references are used whole. The buffer keeps the object at index 1 alive.
+function private:pushBuffer(method, value, ctype)
+  local res
+  if ctype.ptr then
+    local len = method.dub.buffer
+    if method.member then
+      len = 'self->' .. len
+    end
+    res = format('%s%s *retval__ = %s;\n', ctype.const and 'const ' or '', ctype.name, value)
+    res = res .. 'if (!retval__) return 0;\n'
+    res = res .. format('dub::pushbuffer('..self.L..', retval__, %s());', len)
   else
-    return res .. '\nreturn 1;'
+    res = format('dub::pushbuffer('..self.L..', %s);', value)
+  end
+  if method.member then
+    res = res .. '\ndub::protect('..self.L..', lua_gettop('..self.L..'), 1, "_");'
   end
+  return res
+end
+
+-- Construct an object of type `rtype` with std::make_shared and the
+-- constructor arguments `args` (including parenthesis) and push the
+-- std::shared_ptr in a new userdata.
+function private:newShared(rtype, type_ref, args)
+  local name = string.sub(rtype.create_name, 1, -3)
+  local res = format('std::shared_ptr<%s> retval__ = std::make_shared<%s>%s;\n', name, name, args)
+  res = res .. format('dub::pushshared('..self.L..', retval__, %s);', type_ref)
+  return res, {owned = true, ptr = 'retval__.get()'}
+end
+
+-- Construct an object of type `rtype` inside a new userdata with the
+-- constructor arguments `args` (including parenthesis). The object is only
+-- finalized if the constructor succeeds.
+function private:newInline(rtype, type_ref, args)
+  local name = string.sub(rtype.create_name, 1, -3)
+  local res = format('DubUserdata *udata__ = dub::newudata<%s>('..self.L..', %s);\n', name, type_ref)
+  res = res .. format('new(udata__->ptr) %s%s;\n', name, args)
+  res = res .. 'udata__->gc = true;'
+  return res, {owned = true, ptr = format('(%s)udata__->ptr', rtype.create_name)}
 end
 
 function private:copyDubFiles()
@@ -1126,10 +1772,21 @@ function private:setAttrBody(class, method, attr, delta)
     res = res .. p
     LNAME = self.L
     p = lua.cast(name)
+  elseif lua.shared then
+    -- std::shared_ptr copy
   elseif lua.type == 'userdata' then
     -- custom type
     if not param.ctype.ptr then
       p = '*' .. p
+    elseif self:refCount(lua.rtype) then
+      -- The attribute holds a reference: retain the new value and release
+      -- the previous one.
+      local retain, release = self:refCount(lua.rtype)
+      local target = attr.static and format('%s::%s', attr.parent.name, name) or format('self->%s', name)
+      res = res .. format('%s%s__ = %s;\n', lua.rtype.create_name, name, p)
+      res = res .. format('%s__->%s();\n', name, retain)
+      res = res .. format('if (%s) %s->%s();\n', target, target, release)
+      p = name .. '__'
     else
       -- protect from gc
       res = res .. format('dub::protect('..self.L..', 1, %i, "%s");\n', param.position + delta, param.name)
@@ -1146,18 +1803,6 @@ function private:setAttrBody(class, method, attr, delta)
   return res
 end
 
--- function body to set a variable.
-function private:castBody(class, method, super, delta)
-  if not super.should_cast then
-    return
-  end
-  local name = super.create_name
-  local res = ''
-  res = res .. format('*retval__ = static_cast<%s>(self);\n', name)
-  res = res .. 'return 1;'
-  return res
-end
-
 -- function body to get a variable.
 function private:getAttrBody(class, method, attr, delta)
   if attr.ctype.const and self.options.read_const_member == 'no' then
@@ -1203,15 +1848,19 @@ function private:switch(class, method, delta, bfunc, iterator)
     method.index_op.name = 'operator[]'
     res = res .. '  ' .. private.callWithParams(self, class, method.index_op, delta, '  ') .. '\n'
     res = res .. '}\n'
-    if not class:hasVariables() then
+    if not class:hasVariables() and self:luaIndex(class) then
       res = res .. 'return 0;'
       return res
     else
       res = res .. '\n'
     end
   end
-  res = res .. private.getParamVar(self, method, param, delta)
-  if method.is_get_attr then
+  local custom = self.custom_bindings[method.parent.name] or {}
+  if method.is_set_attr or custom.get_suffix then
+    -- 'key' is used in error message or custom code.
+    res = res .. private.getParamVar(self, method, param, delta)
+  end
+  if method.is_get_attr and not self:luaIndex(class) then
     res = res .. '// <self> "key" <mt>\n'
     res = res .. '// rawget(mt, key)\n'
     res = res .. 'lua_pushvalue('..self.L..', 2);\n'
@@ -1224,59 +1873,28 @@ function private:switch(class, method, delta, bfunc, iterator)
     res = res .. '  // Not in mt = attribute access.\n'
     res = res .. '  lua_pop('..self.L..', 2);\n'
     res = res .. '}\n'
-  elseif method.is_cast then
-    res = res .. 'void **retval__ = (void**)lua_newuserdata('..self.L..', sizeof(void*));\n'
-  end
-
-  local filter
-
-  if method.is_cast then
-    filter = function(elem)
-      return self:libName(elem)
-    end
-  else
-    filter = function(elem)
-      return self:attrName(elem)
-    end
   end
 
-  local filtered_iterator = function()
-    local function new_iterator()
-      for elem in iterator(class) do
-        local name = filter(elem)
-        if name then
-          coroutine.yield(name)
-        end
+  local cases = ''
+  for elem in iterator(class) do
+    local lua_name = self:attrName(elem)
+    if lua_name then
+      local body = bfunc(self, class, method, elem, delta)
+      if body then
+        -- get or set value
+        cases = cases .. format('  case %i: {\n', self:keyRef(lua_name))
+        cases = cases .. format('    // %s\n', lua_name)
+        cases = cases .. '    ' .. gsub(body, '\n', '\n    ') .. '\n  }\n'
       end
     end
-    return coroutine.wrap(new_iterator)
   end
-
-  -- get key hash
-  local sz = dub.minHash(class, filtered_iterator)
-  if not sz then
-    -- get/set without any public variables but using
-    -- suffix code
-  else
-    res = res .. format('int key_h = dub::hash(key, %i);\n', sz)
-    -- switch
-    res = res .. 'switch(key_h) {\n'
-    for elem in iterator(class) do
-      local lua_name = filter(elem)
-      if lua_name then
-        local body = bfunc(self, class, method, elem, delta)
-        if body then
-          res = res .. format('  case %i: {\n', dub.hash(lua_name, sz))
-          -- get or set value
-          res = res .. format('    if (DUB_ASSERT_KEY(key, "%s")) break;\n', lua_name)
-          res = res .. '    ' .. gsub(body, '\n', '\n    ') .. '\n  }\n'
-        end
-      end
-    end
+  if cases ~= '' then
+    -- get/set without any public variables can still use suffix code
+    res = res .. format('switch(dub::keyindex('..self.L..', %i)) {\n', delta + 1)
+    res = res .. cases
     res = res .. '}\n'
   end
 
-  local custom = self.custom_bindings[method.parent.name] or {}
   if method.is_set_attr then
     if custom.set_suffix then
       res = res .. custom.set_suffix
@@ -1496,6 +2114,7 @@ function private:makeLibFile(lib_name, list)
     lib.has_constants = lib:hasConstants()
   end
 
+  self.types = nil
   local res = self.lib_template:run {
     dub      = dub,
     lib      = lib,
@@ -1503,6 +2122,7 @@ function private:makeLibFile(lib_name, list)
     classes  = list,
     self     = self,
   }
+  res = private.declareTypes(self, res)
 
   local openname = self.options.luaopen or lib_name
   local path = self.output_directory .. lub.Dir.sep .. openname .. '.cpp'
@@ -1614,6 +2234,58 @@ function private:expandClass(class)
     end
   end
   dub.MemoryStorage.makeSpecialMethods(class, self.custom_bindings)
+  if self:iterable(class) == 'range' then
+    -- Iterators are walked with iter() and not bound.
+    class.ignore['begin'] = true
+    class.ignore['end']   = true
+  end
+end
+
+-- Replace the types placeholder in the generated file with the list of types
+-- collected with lib:typeRef during generation.
+function private:declareTypes(res)
+  local types = self.types or {list = {}}
+  local decl = {}
+  local list = {}
+  local class = types.cast_class
+  if class then
+    -- Casts from the bound class to its super classes.
+    local casts = {}
+    for super in class:superclasses() do
+      if super.should_cast then
+        local name = format('dub_cast_%i', #casts + 1)
+        insert(decl, format('static void *%s(void *ptr) {\n', name))
+        insert(decl, format('  return static_cast<%s>((%s)ptr);\n', super.create_name, class.create_name))
+        insert(decl, '}\n\n')
+        insert(casts, format('  { 0x%08x, %s },\n', self:typeId(self:libName(super)), name))
+      end
+    end
+    insert(decl, 'static const dub::Cast dub_casts[] = {\n')
+    insert(decl, lub.join(casts, ''))
+    insert(decl, '  { 0, NULL },\n')
+    insert(decl, '};\n\n')
+  end
+  for i, mt_name in ipairs(types.list) do
+    local casts = (class and i == 1) and 'dub_casts' or 'NULL'
+    local methods = types.methods[mt_name] or 'NULL'
+    insert(list, format('  { %-20s, %i, 0x%08x, %s, %s },\n', '"'..mt_name..'"', i, self:typeId(mt_name), casts, methods))
+  end
+  insert(decl, 'static const dub::Type dub_types[] = {\n')
+  insert(decl, lub.join(list, ''))
+  insert(decl, '  { NULL, 0, 0, NULL, NULL },\n')
+  insert(decl, '};\n')
+  if class then
+    -- Attribute keys used by __index and __newindex.
+    insert(decl, '\nstatic const char *const dub_keys[] = {\n')
+    for _, name in ipairs(self.keys and self.keys.list or {}) do
+      insert(decl, format('  "%s",\n', name))
+    end
+    insert(decl, '  NULL,\n')
+    insert(decl, '};\n')
+  end
+  return (gsub(res, '/%* dub types %*/\n', function()
+    return lub.join(decl, '')
+  end, 1))
 end
 
 private.makeType = dub.MemoryStorage.makeType
@@ -19,6 +19,13 @@ local find = xml.find
 -- Pattern to check for Doxygen version
 local DOXYGEN_VERSIONS = {"1%.7%.", "1%.8%."}
 
+-- Element types of C array attributes with bulk access methods.
+local ARRAY_OP_TYPES = {double = true, float = true, int = true}
+
+-- Arithmetic operators with allocation-free variants: add_into(v, out) and
+-- add_assign(v) for 'operator+'.
+local OP_VARIANTS = {['+'] = 'add', ['-'] = 'sub', ['*'] = 'mul', ['/'] = 'div'}
+
 -- Create a new storage engine for parsed content.
 function lib.new()
   local self = {
@@ -819,6 +826,12 @@ parse['function'] = function(self, elem, header)
     else
       child.index_op = child
     end
+  elseif self.is_class and (name == 'begin' or name == 'end') and
+         #child.params_list == 0 and private.isIterator(child.return_value) then
+    -- Used by dub.LuaBinder to walk begin()/end() ranges with iter() (the
+    -- methods are then not bound).
+    self.iter_range = self.iter_range or {}
+    self.iter_range[name] = self.iter_range[name] or child
   end
 
   if name == 'operator-' and #child.params_list == 0 then
@@ -853,6 +866,12 @@ parse['function'] = function(self, elem, header)
   end
 end
 
+-- Return true if the return value of begin() or end() is an iterator or a
+-- pointer.
+function private.isIterator(ctype)
+  return ctype and (ctype.ptr or match(ctype.name, 'iterator$')) and true
+end
+
 function parse.params(elem, header)
   local res = {str = find(elem, 'argsstring')[1]}
   local i = 0
@@ -982,7 +1001,17 @@ end
 
 -- self == class
 function private:makeDestructor()
-  if self.cache['~' .. self.name]  or
+  local dtor = self.cache['~' .. self.name]
+  -- Objects with a reference count are released and can have a private
+  -- destructor.
+  if dtor == 'private' and self.dub.release then
+    if dub.Class.refCount(self) then
+      dtor = nil
+    else
+      dub.warn(1, "Private destructor in '%s': '@dub release' needs '@dub retain' (objects are never released).", self.name)
+    end
+  end
+  if dtor                          or
      self.ignore['~' .. self.name] or
      self.dub.destroy == 'free' then
     -- Destructor not needed.
@@ -1023,29 +1052,111 @@ function lib.makeSpecialMethods(class, custom_bindings)
     custom_bindings = {}
   end
 
-  if private.needsCast(class.db, class) then
-    private.makeCast(class)
-  end
-
   private.makeGetAttribute(class, custom_bindings[class.name] or {})
   private.makeSetAttribute(class, custom_bindings[class.name] or {})
   private.makeDestructor(class)
+  private.makeOpVariants(class)
 end
 
-function private:needsCast(class)
-  for _, name in ipairs(class.super_list) do
-    local super = self:resolveType(class.parent or self, name)
-    if super and super.should_cast then
-      return true
+-- self == class
+-- Create name_into(v, out) (out = self op v) and name_assign(v) (self = self
+-- op v) for binary arithmetic operators returning the class by value. The
+-- result is written in an existing object instead of a new one. Each
+-- matching overload of the operator gets its variants (overloads of the
+-- variant methods).
+function private:makeOpVariants()
+  if self.made_op_variants or self.template_params or
+     self.cache['operator='] == 'private' then
+    return
+  end
+  self.made_op_variants = true
+  local list = self.functions_list
+  local i = 1
+  while i <= #list do
+    local met = list[i]
+    local base = OP_VARIANTS[match(met.name, '^operator(.+)$') or '']
+    if base then
+      for _, op in ipairs(met.overloaded or {met}) do
+        local ret = op.return_value
+        if #op.params_list == 1 and ret and not ret.ptr and not ret.ref and
+           (ret.name == self.name or self.db:resolveType(self, ret.name) == self) then
+          for _, kind in ipairs {'into', 'assign'} do
+            if private.makeOpVariant(self, op, base .. '_' .. kind, kind, i + 1) then
+              i = i + 1
+            end
+          end
+        end
+      end
     end
+    i = i + 1
+  end
+end
+
+-- self == class
+-- Returns true if the variant was inserted in functions_list at `pos` (false
+-- if it was added as an overload of the variant of another overload).
+function private:makeOpVariant(op, name, kind, pos)
+  local param = op.params_list[1]
+  local params_list = {{
+    type     = 'dub.Param',
+    name     = param.name,
+    position = 1,
+    ctype    = param.ctype,
+  }}
+  local arg = format('%s %s', param.ctype.def or param.ctype.name, param.name)
+  local argsstring = '(' .. arg .. ')'
+  if kind == 'into' then
+    insert(params_list, {
+      type     = 'dub.Param',
+      name     = 'out',
+      position = 2,
+      ctype    = lib.makeType(self.name .. ' &'),
+    })
+    argsstring = format('(%s, %s &out)', arg, self.name)
+  end
+  local exist = self.cache[name]
+  if exist and not exist.op_variant then
+    -- Method defined in the class.
+    return false
+  end
+  local child = dub.Function {
+    db            = self.db,
+    parent        = self,
+    name          = name,
+    params_list   = params_list,
+    return_value  = nil,
+    definition    = name,
+    argsstring    = argsstring,
+    location      = op.location,
+    desc          = format('%s without allocation (%s).', op.name, kind),
+    static        = false,
+    xml           = nil,
+    -- Should not be inherited by sub-classes
+    no_inherit    = true,
+    member        = true,
+    op_variant    = kind,
+    op_method     = op,
+  }
+  if not child then
+    -- ignored
+    return false
   end
-  for _, name in ipairs(class.dub.super or {}) do
-    local super = self:resolveType(class.parent or self, name)
-    if super and super.should_cast then
-      return true
+  if exist then
+    -- Variant of another overload.
+    local list = exist.overloaded or {exist}
+    for _, met in ipairs(list) do
+      if met.sign == child.sign then
+        return false
+      end
     end
+    insert(list, child)
+    exist.overloaded = list
+    return false
   end
-  return false
+  insert(self.functions_list, pos, child)
+  insert(self.sorted_cache, child)
+  self.cache[name] = child
+  return true
 end
 
 -- self == class
@@ -1113,6 +1224,39 @@ function private:makeAttrArrayMethods(attr)
   }
 
   insert(overloaded, child)
+
+  if attr.ctype.ptr or not ARRAY_OP_TYPES[attr.ctype.name] then
+    return
+  end
+  -- Bulk access: name_slice(first, last, t), name_setslice(t, first),
+  -- name_fill(value), name_copy(other) and name_buffer() (dub::Buffer).
+  for _, op in ipairs {'slice', 'setslice', 'fill', 'copy', 'buffer'} do
+    local op_name = name .. '_' .. op
+    if not self.cache[op_name] then
+      child = dub.Function {
+        db            = self.db,
+        parent        = self,
+        name          = op_name,
+        params_list   = {},
+        return_value  = nil,
+        definition    = 'Bulk access to ' .. name,
+        argsstring    = '()',
+        location      = '',
+        desc          = format('Bulk access (%s) to attribute %s for %s.', op, name, self.name),
+        static        = false,
+        xml           = nil,
+        -- Should not be inherited by sub-classes
+        no_inherit    = true,
+        member        = true,
+        array_op      = op,
+        array_attr    = name,
+        array_dim     = attr.array_dim,
+      }
+      insert(self.functions_list, child)
+      insert(self.sorted_cache, child)
+      self.cache[op_name] = child
+    end
+  end
 end
 
 -- self == class
@@ -1176,33 +1320,6 @@ function private:makeSetAttribute(custom_bindings)
   self.cache[child.name] = child
 end
 
-function private:makeCast()
-  if self.cache[self.CAST_NAME] then
-    return
-  end
-  local name = self.CAST_NAME
-  local child = dub.Function {
-    db            = self.db,
-    parent        = self,
-    name          = name,
-    params_list   = {},
-    return_value  = nil,
-    definition    = 'Cast ',
-    argsstring    = '(class_name)',
-    location      = '',
-    desc          = 'Cast to superclass for ' .. self.name .. '.',
-    static        = false,
-    xml           = nil,
-    -- Should not be inherited by sub-classes
-    no_inherit    = true,
-    is_cast       = true,
-    member        = true,
-  }
-  insert(self.functions_list, 1, child)
-  insert(self.sorted_cache, 1, child)
-  self.cache[child.name] = child
-end
-
 function private.flatten(xml)
   if type(xml) == 'string' then
     return xml
@@ -1341,6 +1458,12 @@ function parse.throw(elem)
   if ex then
     return lub.strip(ex[1])
   end
+  -- C++11 noexcept specification is part of the argsstring.
+  local args = (find(elem, 'argsstring') or {})[1]
+  if args then
+    return match(args, '%)[^%)]*(noexcept%s*%b())') or
+           match(args, '%)[^%)]*(noexcept)')
+  end
 end
 
 return lib
@@ -15,22 +15,50 @@
 using namespace {{class:namespace().name}};
 {% end %}
 
+// --=============================================== TYPES
+/* dub types */
+{% if self:poolAllocator(class) then %}
+
+// Objects created by the constructors (one pool per lua_State).
+static dub::ClassPool dub_pool(sizeof({{string.sub(class.create_name, 1, -3)}}));
+{% end %}
+{% if self:classStats(class) then %}
+
+// Object statistics (see dub::stats).
+static dub::ClassStats dub_stats("{{self:libName(class)}}", sizeof({{string.sub(class.create_name, 1, -3)}}));
+{% end %}
+{% if self:gcSize(class) then %}
+
+// Native memory held by an object (reported to the Lua collector).
+static size_t dub_gcsize({{class.create_name}}self) {
+  return {{self:gcSize(class)}};
+}
+{% end %}
+
 {% for method in class:methods() do %}
 /** {{method:nameWithArgs()}}
  * {{method.location}}
  */
 static int {{class.name}}_{{method.cname}}(lua_State *{{self.L}}) {
-{% if method:neverThrows() then %}
+{% if self:neverThrows(method) then %}
 
   {| self:functionBody(class, method) |}
 {% else %}
   try {
     {| self:functionBody(class, method) |}
+{% if self.options.lazy_errors then %}
+  } catch (std::exception &e) {
+    dub::pusherror({{self.L}}, "{{self:bindName(method)}}", e);
+  } catch (...) {
+    dub::pusherror({{self.L}}, "{{self:bindName(method)}}");
+  }
+{% else %}
   } catch (std::exception &e) {
     lua_pushfstring({{self.L}}, "{{self:bindName(method)}}: %s", e.what());
   } catch (...) {
     lua_pushfstring({{self.L}}, "{{self:bindName(method)}}: Unknown exception");
   }
+{% end %}
   return dub::error({{self.L}});
 {% end %}
 }
@@ -46,6 +74,38 @@ static int {{class.name}}___tostring(lua_State *{{self.L}}) {
 }
 {% end %}
 
+{% if self:poolAllocator(class) then %}
+
+// --=============================================== _pool_
+static int {{class.name}}__pool_(lua_State *{{self.L}}) {
+  dub::pushstats({{self.L}}, dub_pool.get({{self.L}}).stats());
+  return 1;
+}
+{% end %}
+
+{% if self:classStats(class) then %}
+
+// --=============================================== _stats_
+static int {{class.name}}__stats_(lua_State *{{self.L}}) {
+  dub::pushstats({{self.L}}, dub_stats);
+  return 1;
+}
+{% end %}
+
+{% if self:iterable(class) then %}
+
+// --=============================================== iter
+{% if self:iterable(class) == 'index' then %}
+static int {{class.name}}__iter_next(lua_State *{{self.L}}) {
+  {| self:iterNextBody(class) |}
+}
+
+{% end %}
+static int {{class.name}}__iter_(lua_State *{{self.L}}) {
+  {| self:iterBody(class) |}
+}
+{% end %}
+
 // --=============================================== METHODS
 
 static const struct luaL_Reg {{class.name}}_member_methods[] = {
@@ -54,6 +114,16 @@ static const struct luaL_Reg {{class.name}}_member_methods[] = {
 {% end %}
 {% if not class:method('__tostring') then %}
   { {{string.format('%-15s, %-20s', '"__tostring"', class.name .. '___tostring')}} },
+{% end %}
+{% if self:poolAllocator(class) then %}
+  { {{string.format('%-15s, %-20s', '"_pool_"', class.name .. '__pool_')}} },
+{% end %}
+{% if self:classStats(class) then %}
+  { {{string.format('%-15s, %-20s', '"_stats_"', class.name .. '__stats_')}} },
+{% end %}
+{% if self:iterable(class) then %}
+  { {{string.format('%-15s, %-20s', '"iter"', class.name .. '__iter_')}} },
+  { {{string.format('%-15s, %-20s', '"__pairs"', class.name .. '__iter_')}} },
 {% end %}
   { "deleted"      , dub::isDeleted       },
   { NULL, NULL},
@@ -80,9 +150,17 @@ DUB_EXPORT int luaopen_{{self:openName(class)}}(lua_State *{{self.L}})
 {% end %}
 
   // register member methods
-  dub::fregister({{self.L}}, {{ class.name }}_member_methods);
+  dub::fregister({{self.L}}, {{ class.name }}_member_methods, dub_types, dub_keys);
   // setup meta-table
-  dub::setup({{self.L}}, "{{self:libName(class)}}");
+  dub::setup({{self.L}}, dub_types[0]);
+{% if self:identity(class) then %}
+  // same userdata for the same pointer
+  dub::identity({{self.L}});
+{% end %}
+{% if self:luaIndex(class) then %}
+  // find methods before calling __index
+  dub::luaindex({{self.L}});
+{% end %}
   // <mt>
   return 1;
 }
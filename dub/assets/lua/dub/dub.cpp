@@ -31,24 +31,33 @@
 #include <stdlib.h>  // malloc
 #include <string.h>  // strlen strcmp
 #include <assert.h>  // assert
+#include <limits.h>  // INT_MAX
 
-#define DUB_EXCEPTION_BUFFER_SIZE 256  
 #define TYPE_EXCEPTION_MSG "expected %s, found %s"
 #define TYPE_EXCEPTION_SMSG "expected %s, found %s (using super)"
 #define DEAD_EXCEPTION_MSG  "using deleted %s"
+#define UNKNOWN_EXCEPTION_MSG "Unknown exception"
+#define DUB_ERROR_MT "dub.Error"
 #define DUB_MAX_IN_SHIFT 4294967296
 
 #if LUA_VERSION_NUM > 501
 #define DUB_LUA_FIVE_TWO
+#define dub_rawlen lua_rawlen
 #else
 #define DUB_LUA_FIVE_ONE
+#define dub_rawlen lua_objlen
 #endif 
 
 #define DUB_INIT_CODE "local class = ...\nif class.new then\nsetmetatable(class, {\n __call = function(lib, ...)\n   return lib.new(...)\n end,\n})\nend\n"
 #define DUB_INIT_ERR "[string \"Dub init code\"]"
+#define DUB_INDEX_CODE "local mt = ...\nlocal get = mt.__index\nmt.__index = function(self, key)\n  local m = mt[key]\n  if m ~= nil then return m end\n  return get(self, key)\nend\n"
+// Registry table used to detect class id collisions.
+#define DUB_TYPE_IDS "dub.type_ids"
 // Define the callback error function. We store the error function in
 // self._errfunc so that it can also be used from Lua (this error function
 // captures the currently global 'print' which is useful for remote network objects).
+// The chunk also returns the function used by dub_flush to execute queued calls:
+// a single protected call runs all calls and restarts after a failing call.
 #define DUB_ERRFUNC "local self, print = ...\n\
 local errfunc = function(...)\n\
   local err = self.error\n\
@@ -59,7 +68,29 @@ local errfunc = function(...)\n\
   end\n\
 end\n\
 self._errfunc = errfunc\n\
-return errfunc"
+local xpcall, unpack = xpcall, unpack or table.unpack\n\
+local queue, pos, last\n\
+local run = function()\n\
+  local q, i, n = queue, pos, last\n\
+  while i < n do\n\
+    local f, argc = self[q[i]], q[i + 1]\n\
+    local j = i + 2\n\
+    i = j + argc\n\
+    pos = i\n\
+    if f then\n\
+      if argc == 0 then f(self)\n\
+      elseif argc == 1 then f(self, q[j])\n\
+      elseif argc == 2 then f(self, q[j], q[j + 1])\n\
+      else f(self, unpack(q, j, i - 1)) end\n\
+    end\n\
+  end\n\
+end\n\
+local flush = function(q, n)\n\
+  queue, pos, last = q, 1, n\n\
+  while pos < n and not xpcall(run, errfunc) do end\n\
+  queue = nil\n\
+end\n\
+return errfunc, flush"
 
 using namespace dub;
 
@@ -84,46 +115,105 @@ void dub::printStack(lua_State *L, const char *msg) {
 // ======================================================================
 // =============================================== dub::Exception
 // ======================================================================
-Exception::Exception(const char *format, ...) {
-  char buffer[DUB_EXCEPTION_BUFFER_SIZE];
+Exception::Exception(const char *format, ...)
+  : format_(NULL)
+  , type_(NULL)
+  , found_(NULL)
+  , narg_(0) {
   va_list args;
   va_start(args, format);
-    vsnprintf(buffer, DUB_EXCEPTION_BUFFER_SIZE, format, args);
+    vsnprintf(message_, DUB_EXCEPTION_BUFFER_SIZE, format, args);
   va_end(args);
-  message_ = buffer;
 }
 
-Exception::~Exception() throw() {}
+Exception::Exception()
+  : format_(NULL)
+  , type_(NULL)
+  , found_(NULL)
+  , narg_(0) {
+  message_[0] = '\0';
+}
+
+Exception::~Exception() DUB_NOTHROW {}
 
-const char* Exception::what() const throw() {
-  return message_.c_str();
+const char* Exception::what() const DUB_NOTHROW {
+  if (format_ && !message_[0]) {
+    snprintf(message_, DUB_EXCEPTION_BUFFER_SIZE, format_, type_, found_);
+  }
+  return message_;
 }
 
 
-TypeException::TypeException(lua_State *L, int narg, const char *type, bool is_super) :
-  Exception(is_super ? TYPE_EXCEPTION_SMSG : TYPE_EXCEPTION_MSG, type, luaL_typename(L, narg)) {}
+TypeException::TypeException(lua_State *L, int narg, const char *type, bool is_super) {
+  format_ = is_super ? TYPE_EXCEPTION_SMSG : TYPE_EXCEPTION_MSG;
+  type_   = type;
+  found_  = luaL_typename(L, narg);
+  narg_   = narg;
+}
+
+DeadException::DeadException(const char *type, int narg) {
+  format_ = DEAD_EXCEPTION_MSG;
+  type_   = type;
+  narg_   = narg;
+}
 
 // ======================================================================
 // =============================================== dub::Object
 // ======================================================================
 void Object::dub_pushobject(lua_State *L, void *ptr, const char *tname, bool gc) {
+  lua_getfield(L, LUA_REGISTRYINDEX, tname);
+  // <mt/nil>
+  if (lua_istable(L, -1)) {
+    lua_pushlstring(L, "_cache_", 7);
+    lua_rawget(L, -2);
+  } else {
+    // Class not loaded yet.
+    lua_pushnil(L);
+  }
+  // <mt/nil> <cache/nil>
+  bool cached = lua_istable(L, -1);
+  if (cached && dub_userdata_) {
+    lua_pushlightuserdata(L, ptr);
+    lua_rawget(L, -2);
+    // <mt> <cache> <udata/nil>
+    DubUserdata *udata = (DubUserdata *)lua_touserdata(L, -1);
+    if (udata == dub_userdata_ && udata->ptr == ptr) {
+      // Same object.
+      lua_replace(L, -3);
+      lua_pop(L, 1);
+      // <udata>
+      return;
+    }
+    lua_pop(L, 1);
+  }
+
   DubUserdata *udata = (DubUserdata*)lua_newuserdata(L, sizeof(DubUserdata));
-  udata->ptr = ptr;
-  udata->gc  = gc;
+  initudata(udata, ptr, NULL, gc);
   if (dub_userdata_) {
     // We already have a userdata. Push a new userdata (copy to this item,
     // should never gc).
     assert(!gc);
     udata->gc = false;
+    cached = false;
   } else {
     // First initialization.
     dub_userdata_ = udata;
   }
   // the userdata is now on top of the stack
+  // <mt> <cache/nil> <udata>
 
   // set metatable (contains methods)
-  lua_getfield(L, LUA_REGISTRYINDEX, tname);
+  lua_pushvalue(L, -3);
+  udata->type = mttype(L, -1);
   lua_setmetatable(L, -2);
+  if (cached) {
+    // Only the first userdata is cached (invalidated by ~Object).
+    lua_pushlightuserdata(L, ptr);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4); // cache[ptr] = udata
+  }
+  lua_replace(L, -3);
+  lua_pop(L, 1);
   // <udata>
 }
 
@@ -220,28 +310,35 @@ void Thread::dub_pushobject(lua_State *L, void *ptr, const char *tname, bool gc)
 
   // <self> <udata> <env> (errloader) <self> (print)
   
-  error = lua_pcall(L, 2, 1, 0);
+  error = lua_pcall(L, 2, 2, 0);
   if (error) {
     throw Exception("Error executing error function code (%s).", lua_tostring(L, -1));
   }
   
 
-  // <self> <udata> <env> <errfunc>
-  lua_remove(L, -2);
-  // <self> <udata> <errfunc>
-  lua_remove(L, -2);
-  // <self> <errfunc>
+  // <self> <udata> <env> <errfunc> <flush>
+  lua_remove(L, -3);
+  // <self> <udata> <errfunc> <flush>
+  lua_remove(L, -3);
+  // <self> <errfunc> <flush>
 
   //--=============================================== prepare thread stack
   // Transfer a copy of <self> to thread stack
-  lua_pushvalue(L, -2);
-  // <self> <errfunc> <self>
-  lua_pushvalue(L, -2);
-  // <self> <errfunc> <self> <errfunc>
+  lua_pushvalue(L, -3);
+  // <self> <errfunc> <flush> <self>
+  lua_pushvalue(L, -3);
+  // <self> <errfunc> <flush> <self> <errfunc>
   lua_xmove(L, dub_L, 2);
+  // <self> <errfunc> <flush>
+
+  // Callback keys (see dub_callbackref).
+  lua_newtable(dub_L);
+  // Queued calls (see dub_queuecallback).
+  lua_newtable(dub_L);
+  lua_xmove(L, dub_L, 1);
   lua_pop(L, 1);
 
-  // dub_L: <self> <errfunc>
+  // dub_L: <self> <errfunc> <keys> <queue> <flush>
   // L:     <self>
 }
 
@@ -252,38 +349,1035 @@ bool Thread::dub_pushcallback(const char *name) const {
     lua_pop(L, 1);
     return false;
   } else {
-    lua_pushvalue(L, 1);
-    // ... <func> <self>
-    return true;
+    lua_pushvalue(L, 1);
+    // ... <func> <self>
+    return true;
+  }
+}
+
+void Thread::dub_pushvalue(const char *name) const {
+  lua_State *L = const_cast<lua_State *>(dub_L);
+  lua_getfield(L, 1, name);
+}
+
+int Thread::dub_callbackref(const char *name) {
+  lua_State *L = dub_L;
+  lua_getfield(L, 3, name);
+  // ... <ref>
+  int ref = (int)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (!ref) {
+    ref = (int)dub_rawlen(L, 3) + 1;
+    lua_pushstring(L, name);
+    // ... "name"
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, 3, ref); // keys[ref] = "name"
+    lua_pushinteger(L, ref);
+    lua_rawset(L, 3);       // keys["name"] = ref
+  }
+  return ref;
+}
+
+bool Thread::dub_pushcallback(int ref) const {
+  lua_State *L = const_cast<lua_State *>(dub_L);
+  lua_rawgeti(L, 3, ref);
+  // ... "name"
+  lua_gettable(L, 1);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return false;
+  } else {
+    lua_pushvalue(L, 1);
+    // ... <func> <self>
+    return true;
+  }
+}
+
+void Thread::dub_pushvalue(int ref) const {
+  lua_State *L = const_cast<lua_State *>(dub_L);
+  lua_rawgeti(L, 3, ref);
+  lua_gettable(L, 1);
+}
+
+void Thread::dub_queuecallback(int ref, int param_count) {
+  lua_State *L = dub_L;
+  int n = dub_queued_;
+  // ... <param1> ... <paramN>
+  lua_rawgeti(L, 3, ref);
+  lua_rawseti(L, 4, n + 1); // queue[n+1] = "name"
+  lua_pushinteger(L, param_count);
+  lua_rawseti(L, 4, n + 2); // queue[n+2] = param_count
+  n += 2;
+  for (int i = param_count; i > 0; --i) {
+    lua_rawseti(L, 4, n + i);
+  }
+  dub_queued_ = n + param_count;
+}
+
+bool Thread::dub_flush() {
+  int n = dub_queued_;
+  if (!n) return true;
+  lua_State *L = dub_L;
+  lua_pushvalue(L, 5);
+  lua_pushvalue(L, 4);
+  // ... <flush> <queue>
+  // Use a new queue for calls queued during flush.
+  lua_createtable(L, n, 0);
+  lua_replace(L, 4);
+  dub_queued_ = 0;
+  lua_pushinteger(L, n);
+  // ... <flush> <queue> <n>
+  return dub_call(2, 0);
+}
+
+// Atomic operations for the message stack (full barrier).
+#ifdef _MSC_VER
+#include <intrin.h>
+#define dub_cas(ptr, old, val) (_InterlockedCompareExchangePointer((void *volatile *)(ptr), (val), (old)) == (old))
+#define dub_xchg(ptr, val) ((Message *)_InterlockedExchangePointer((void *volatile *)(ptr), (val)))
+#else
+#define dub_cas(ptr, old, val) __sync_bool_compare_and_swap(ptr, old, val)
+#define dub_xchg(ptr, val) __sync_lock_test_and_set(ptr, val)
+#endif
+
+Thread::~Thread() {
+  Message *msg = dub_xchg(&dub_posted_, (Message *)NULL);
+  while (msg) {
+    Message *next = msg->next_;
+    delete msg;
+    msg = next;
+  }
+}
+
+void Thread::dub_post(Message *msg) {
+  Message *head;
+  do {
+    head = dub_posted_;
+    msg->next_ = head;
+  } while (!dub_cas(&dub_posted_, head, msg));
+}
+
+int Thread::dub_drain() {
+  // Take all messages at once: producers only push so there is no ABA
+  // problem.
+  Message *msg = dub_xchg(&dub_posted_, (Message *)NULL);
+  // Reverse to get posting order.
+  Message *list = NULL;
+  int count = 0;
+  while (msg) {
+    Message *next = msg->next_;
+    msg->next_ = list;
+    list = msg;
+    msg = next;
+    ++count;
+  }
+
+  while (list) {
+    msg = list;
+    list = list->next_;
+    if (dub_pushcallback(msg->ref_)) {
+      // <func> <self>
+      int n = msg->push(dub_L);
+      dub_call(n + 1, 0);
+    }
+    delete msg;
+  }
+  return count;
+}
+
+bool Thread::dub_call(int param_count, int retval_count) const {
+  lua_State *L = const_cast<lua_State *>(dub_L);
+  int status = lua_pcall(L, param_count, retval_count, 2);
+  if (status) {
+    if (status == LUA_ERRRUN) {
+      // failure properly handled by the error handler
+    } else if (status == LUA_ERRMEM) {
+      // memory allocation failure
+      fprintf(stderr, "Memory allocation failure (%s).\n", lua_tostring(dub_L, -1));
+    } else {
+      // error in error handler
+      fprintf(stderr, "Error in error handler (%s).\n", lua_tostring(dub_L, -1));
+    }
+    lua_pop(dub_L, 1);
+    return false;
+  }
+  return true;
+}
+
+
+
+
+// ======================================================================
+// =============================================== dub::Pool
+// ======================================================================
+
+// Alignment of the blocks (same as malloc for the types used by bindings).
+union PoolAlign {
+  double d;
+  void *p;
+  long l;
+};
+
+#define DUB_POOL_ALIGN sizeof(PoolAlign)
+#define DUB_POOL_ROUND(s) (((s) + DUB_POOL_ALIGN - 1) / DUB_POOL_ALIGN * DUB_POOL_ALIGN)
+// Number of blocks in the first chunk (doubled for each new chunk).
+#define DUB_POOL_FIRST_COUNT 32
+// Chunks stop growing at this size (bytes of blocks).
+#define DUB_POOL_MAX_CHUNK (64 * 1024)
+#define DUB_POOL_HEAD DUB_POOL_ROUND(sizeof(Chunk))
+
+struct dub::Pool::Chunk {
+  Chunk *next;
+  char *begin;
+  char *end;
+};
+
+dub::Pool::Pool(size_t size)
+  : size_(DUB_POOL_ROUND(size < sizeof(void*) ? sizeof(void*) : size))
+  , count_(DUB_POOL_FIRST_COUNT)
+  , free_(NULL)
+  , chunks_(NULL) {
+  stats_.live = 0;
+  stats_.high_water = 0;
+  stats_.bytes = 0;
+}
+
+void *dub::Pool::alloc() {
+  if (!free_) {
+    // Reserve a new chunk and thread its blocks in the free list.
+    size_t bytes = DUB_POOL_HEAD + count_ * size_;
+    Chunk *chunk = (Chunk*)malloc(bytes);
+    if (!chunk) throw std::bad_alloc();
+    chunk->begin = (char*)chunk + DUB_POOL_HEAD;
+    chunk->end   = chunk->begin + count_ * size_;
+    chunk->next  = chunks_;
+    chunks_ = chunk;
+    for (size_t i = count_; i > 0; --i) {
+      void *block = chunk->begin + (i - 1) * size_;
+      *(void**)block = free_;
+      free_ = block;
+    }
+    stats_.bytes += bytes;
+    if (2 * count_ * size_ <= DUB_POOL_MAX_CHUNK) {
+      count_ *= 2;
+    }
+  }
+  void *ptr = free_;
+  free_ = *(void**)ptr;
+  if (++stats_.live > stats_.high_water) {
+    stats_.high_water = stats_.live;
+  }
+  return ptr;
+}
+
+void dub::Pool::release() {
+  while (chunks_) {
+    Chunk *chunk = chunks_;
+    chunks_ = chunk->next;
+    ::free(chunk);
+  }
+  free_ = NULL;
+  count_ = DUB_POOL_FIRST_COUNT;
+  stats_.live  = 0;
+  stats_.bytes = 0;
+}
+
+void dub::Pool::free(void *ptr) {
+  *(void**)ptr = free_;
+  free_ = ptr;
+  --stats_.live;
+}
+
+size_t dub::Pool::nextChunkSize() const {
+  return free_ ? 0 : DUB_POOL_HEAD + count_ * size_;
+}
+
+void dub::Pool::adopt(Pool *from) {
+  if (from) --from->stats_.live;
+  ++stats_.live;
+}
+
+// Blocks of a chunk during trim.
+struct DubChunkRange {
+  const char *begin;
+  const char *end;
+  size_t nfree;
+};
+
+static int dub_rangecmp(const void *a, const void *b) {
+  const char *ba = ((const DubChunkRange*)a)->begin;
+  const char *bb = ((const DubChunkRange*)b)->begin;
+  return ba < bb ? -1 : (ba > bb ? 1 : 0);
+}
+
+// Find the range containing 'ptr' in ranges sorted by address (NULL for
+// blocks adopted from malloc).
+static DubChunkRange *dub_findrange(DubChunkRange *ranges, size_t n, const void *ptr) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if ((const char*)ptr < ranges[mid].begin) {
+      hi = mid;
+    } else if ((const char*)ptr >= ranges[mid].end) {
+      lo = mid + 1;
+    } else {
+      return ranges + mid;
+    }
+  }
+  return NULL;
+}
+
+size_t dub::Pool::trim() {
+  size_t n = 0;
+  for (Chunk *chunk = chunks_; chunk; chunk = chunk->next) ++n;
+  if (!n || !free_) return 0;
+  DubChunkRange *ranges = (DubChunkRange*)malloc(n * sizeof(DubChunkRange));
+  if (!ranges) return 0;
+  n = 0;
+  for (Chunk *chunk = chunks_; chunk; chunk = chunk->next, ++n) {
+    ranges[n].begin = chunk->begin;
+    ranges[n].end   = chunk->end;
+    ranges[n].nfree = 0;
+  }
+  qsort(ranges, n, sizeof(DubChunkRange), dub_rangecmp);
+
+  // Count free blocks in each chunk.
+  for (void *block = free_; block; block = *(void**)block) {
+    DubChunkRange *range = dub_findrange(ranges, n, block);
+    if (range) ++range->nfree;
+  }
+
+  // Remove the blocks of empty chunks from the free list (keeping the
+  // order of the other blocks).
+  void *block = free_;
+  void **last = &free_;
+  while (block) {
+    void *next = *(void**)block;
+    DubChunkRange *range = dub_findrange(ranges, n, block);
+    if (!range || range->nfree * size_ < (size_t)(range->end - range->begin)) {
+      *last = block;
+      last = (void**)block;
+    }
+    block = next;
+  }
+  *last = NULL;
+
+  // Release empty chunks.
+  size_t released = 0;
+  Chunk **link = &chunks_;
+  while (*link) {
+    Chunk *chunk = *link;
+    size_t size = chunk->end - chunk->begin;
+    if (dub_findrange(ranges, n, chunk->begin)->nfree * size_ == size) {
+      *link = chunk->next;
+      released += DUB_POOL_HEAD + size;
+      ::free(chunk);
+    } else {
+      link = &chunk->next;
+    }
+  }
+  ::free(ranges);
+  stats_.bytes -= released;
+  return released;
+}
+
+static int ClassPool__gc(lua_State *L) {
+  dub::Pool *pool = (dub::Pool*)lua_touserdata(L, 1);
+  // Objects are finalized before the pool (created later). If some are
+  // still alive, their memory is kept.
+  if (!pool->stats().live) {
+    pool->release();
+  }
+  return 0;
+}
+
+dub::Pool &dub::ClassPool::get(lua_State *L) {
+  lua_pushlightuserdata(L, this);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  // <pool/nil>
+  Pool *pool = (Pool*)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (!pool) {
+    pool = new(lua_newuserdata(L, sizeof(Pool))) Pool(size_);
+    // <pool>
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, ClassPool__gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_pushlightuserdata(L, this);
+    lua_pushvalue(L, -2);
+    // <pool> <key> <pool>
+    lua_rawset(L, LUA_REGISTRYINDEX); // registry[this] = pool
+    lua_pop(L, 1);
+  }
+  return *pool;
+}
+
+void dub::pushstats(lua_State *L, const PoolStats &stats) {
+  lua_createtable(L, 0, 3);
+  lua_pushnumber(L, stats.live);
+  lua_setfield(L, -2, "live");
+  lua_pushnumber(L, stats.high_water);
+  lua_setfield(L, -2, "high_water");
+  lua_pushnumber(L, stats.bytes);
+  lua_setfield(L, -2, "bytes");
+}
+
+// ======================================================================
+// =============================================== dub::Allocator
+// ======================================================================
+
+// Block sizes (tuned for dub userdata, small tables and strings).
+static const size_t DUB_ALLOC_SIZES[DUB_ALLOC_CLASSES] = {
+  16, 32, 48, 64, 80, 96, 128, 160, 192, 256,
+};
+
+// Size class by 16 bytes step.
+static const int DUB_ALLOC_INDEX[DUB_ALLOC_MAX_SMALL / 16 + 1] = {
+  0, 0, 1, 2, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9, 9, 9, 9,
+};
+
+// Size class for an allocation of 'size' bytes (-1 for malloc).
+#define DUB_ALLOC_CLASS(size) ((size) > DUB_ALLOC_MAX_SMALL ? -1 : DUB_ALLOC_INDEX[((size) + 15) / 16])
+
+dub::Allocator::Allocator(size_t limit) {
+  for (int i = 0; i < DUB_ALLOC_CLASSES; ++i) {
+    pools_[i] = new Pool(DUB_ALLOC_SIZES[i]);
+  }
+  stats_.bytes = 0;
+  stats_.peak  = 0;
+  stats_.reserved = 0;
+  stats_.limit = limit;
+  stats_.large = 0;
+  adopted_ = 0;
+}
+
+dub::Allocator::~Allocator() {
+  if (adopted_) releaseAdopted();
+  for (int i = 0; i < DUB_ALLOC_CLASSES; ++i) {
+    pools_[i]->release();
+    delete pools_[i];
+  }
+}
+
+lua_State *dub::Allocator::newstate() {
+  return lua_newstate(alloc, this);
+}
+
+dub::Allocator *dub::Allocator::get(lua_State *L) {
+  void *ud;
+  if (lua_getallocf(L, &ud) == alloc) {
+    return (Allocator*)ud;
+  }
+  return NULL;
+}
+
+size_t dub::Allocator::classSize(int i) {
+  return DUB_ALLOC_SIZES[i];
+}
+
+void *dub::Allocator::alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+  Allocator *self = (Allocator*)ud;
+  AllocStats &stats = self->stats_;
+  // With Lua 5.2 and later, osize is the object type when ptr is NULL.
+  if (!ptr) osize = 0;
+  int ocls = ptr ? DUB_ALLOC_CLASS(osize) : -1;
+
+  if (nsize == 0) {
+    if (ptr) {
+      if (ocls < 0) {
+        free(ptr);
+        --stats.large;
+        stats.reserved -= osize;
+      } else {
+        self->pools_[ocls]->free(ptr);
+      }
+      stats.bytes -= osize;
+    }
+    return NULL;
+  }
+
+  int ncls = DUB_ALLOC_CLASS(nsize);
+  bool shrink = ptr && nsize <= osize;
+  void *nptr;
+  if (ptr && ocls == ncls) {
+    // Same block size.
+    if (ocls >= 0) {
+      nptr = ptr;
+    } else if (shrink) {
+      nptr = realloc(ptr, nsize);
+      // Shrinking never fails: keep the larger block.
+      if (!nptr) nptr = ptr;
+      stats.reserved -= osize - nsize;
+    } else {
+      if (!self->reserve(nsize - osize)) return NULL;
+      nptr = realloc(ptr, nsize);
+      if (!nptr) return NULL;
+      stats.reserved += nsize - osize;
+    }
+  } else {
+    // A block leaving malloc frees more than it reserves: ignore the limit.
+    nptr = self->newblock(ncls, nsize, shrink && ocls < 0);
+    if (!nptr) {
+      if (!shrink) return NULL;
+      // Shrinking never fails: keep the block in place and count it in the
+      // new size class (a malloc block then stays reserved until the
+      // allocator is destroyed, see releaseAdopted).
+      if (ocls < 0) {
+        --stats.large;
+        ++self->adopted_;
+      }
+      self->pools_[ncls]->adopt(ocls < 0 ? NULL : self->pools_[ocls]);
+      nptr = ptr;
+    } else if (ptr) {
+      memcpy(nptr, ptr, osize < nsize ? osize : nsize);
+      if (ocls < 0) {
+        free(ptr);
+        --stats.large;
+        stats.reserved -= osize;
+      } else {
+        self->pools_[ocls]->free(ptr);
+      }
+    }
+  }
+
+  stats.bytes += nsize - osize;
+  if (stats.bytes > stats.peak) {
+    stats.peak = stats.bytes;
+  }
+  return nptr;
+}
+
+void *dub::Allocator::newblock(int cls, size_t size, bool nolimit) {
+  size_t need = cls < 0 ? size : pools_[cls]->nextChunkSize();
+  if (need && !nolimit && !reserve(need)) return NULL;
+  void *ptr;
+  if (cls < 0) {
+    ptr = malloc(size);
+    if (!ptr) return NULL;
+    ++stats_.large;
+  } else {
+    try {
+      ptr = pools_[cls]->alloc();
+    } catch (std::bad_alloc &) {
+      return NULL;
+    }
+  }
+  stats_.reserved += need;
+  return ptr;
+}
+
+void dub::Allocator::releaseAdopted() {
+  size_t n = 0;
+  for (int i = 0; i < DUB_ALLOC_CLASSES; ++i) {
+    for (Pool::Chunk *chunk = pools_[i]->chunks_; chunk; chunk = chunk->next) ++n;
+  }
+  DubChunkRange *ranges = (DubChunkRange*)malloc((n ? n : 1) * sizeof(DubChunkRange));
+  if (!ranges) return;
+  n = 0;
+  for (int i = 0; i < DUB_ALLOC_CLASSES; ++i) {
+    for (Pool::Chunk *chunk = pools_[i]->chunks_; chunk; chunk = chunk->next, ++n) {
+      ranges[n].begin = chunk->begin;
+      ranges[n].end   = chunk->end;
+    }
+  }
+  qsort(ranges, n, sizeof(DubChunkRange), dub_rangecmp);
+
+  // Blocks outside of all the chunks come from malloc (blocks adopted from
+  // another pool are in its chunks).
+  for (int i = 0; i < DUB_ALLOC_CLASSES; ++i) {
+    void **last = &pools_[i]->free_;
+    void *block = *last;
+    while (block) {
+      void *next = *(void**)block;
+      if (dub_findrange(ranges, n, block)) {
+        *last = block;
+        last = (void**)block;
+      } else {
+        free(block);
+        --adopted_;
+      }
+      block = next;
+    }
+    *last = NULL;
+  }
+  free(ranges);
+}
+
+bool dub::Allocator::reserve(size_t size) {
+  if (!stats_.limit || stats_.reserved + size <= stats_.limit) return true;
+  trim();
+  return stats_.reserved + size <= stats_.limit;
+}
+
+size_t dub::Allocator::trim() {
+  size_t released = 0;
+  for (int i = 0; i < DUB_ALLOC_CLASSES; ++i) {
+    released += pools_[i]->trim();
+  }
+  stats_.reserved -= released;
+  return released;
+}
+
+void dub::pushstats(lua_State *L, const Allocator &alloc) {
+  const AllocStats &stats = alloc.stats();
+  lua_createtable(L, 0, 6);
+  lua_pushnumber(L, stats.bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushnumber(L, stats.peak);
+  lua_setfield(L, -2, "peak");
+  lua_pushnumber(L, stats.reserved);
+  lua_setfield(L, -2, "reserved");
+  lua_pushnumber(L, stats.limit);
+  lua_setfield(L, -2, "limit");
+  lua_pushnumber(L, stats.large);
+  lua_setfield(L, -2, "large");
+  lua_createtable(L, DUB_ALLOC_CLASSES, 0);
+  for (int i = 0; i < DUB_ALLOC_CLASSES; ++i) {
+    pushstats(L, alloc.classStats(i));
+    lua_pushnumber(L, Allocator::classSize(i));
+    lua_setfield(L, -2, "size");
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "classes");
+}
+
+int dub::memstats(lua_State *L) {
+  Allocator *alloc = Allocator::get(L);
+  if (!alloc) return 0;
+  pushstats(L, *alloc);
+  return 1;
+}
+
+// ======================================================================
+// =============================================== dub::gcaccount
+// ======================================================================
+
+// Registry field holding the dub::GcStats of a state (shared by all the
+// libraries using dub in the state).
+#define DUB_GC_STATS "dub.GcStats"
+
+static dub::GcStats *getgcstats(lua_State *L, bool create) {
+  lua_getfield(L, LUA_REGISTRYINDEX, DUB_GC_STATS);
+  dub::GcStats *stats = (dub::GcStats *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (!stats && create) {
+    stats = (dub::GcStats *)lua_newuserdata(L, sizeof(dub::GcStats));
+    memset(stats, 0, sizeof(dub::GcStats));
+    lua_setfield(L, LUA_REGISTRYINDEX, DUB_GC_STATS);
+  }
+  return stats;
+}
+
+void dub::gcaccount(lua_State *L, DubUserdata *udata, size_t size) {
+  // The header only stores 32 bits.
+  if (size > UINT_MAX) size = UINT_MAX;
+  size_t old = udata->gcsize;
+  if (size == old) return;
+  GcStats *stats = getgcstats(L, size > old);
+  if (!stats) return;
+  udata->gcsize = size;
+  if (!old) {
+    ++stats->objects;
+  } else if (!size) {
+    --stats->objects;
+  }
+
+  if (size < old) {
+    stats->bytes -= old - size;
+    return;
+  }
+
+  stats->bytes += size - old;
+  if (stats->bytes > stats->peak) {
+    stats->peak = stats->bytes;
+  }
+  stats->debt += size - old;
+  if (stats->debt >= 1024) {
+    size_t kb = stats->debt >> 10;
+    stats->debt &= 1023;
+    ++stats->steps;
+    // The step can run finalizers (this object is on the stack or already
+    // accounted).
+    lua_gc(L, LUA_GCSTEP, kb > INT_MAX ? INT_MAX : (int)kb);
+  }
+}
+
+// Userdata at 'idx' or in the 'super' field of a table (dub::Thread).
+static DubUserdata *superudata(lua_State *L, int idx) {
+  if (!lua_istable(L, idx)) {
+    return (DubUserdata *)lua_touserdata(L, idx);
+  }
+  lua_pushlstring(L, "super", 5);
+  lua_rawget(L, idx < 0 && idx > LUA_REGISTRYINDEX ? idx - 1 : idx);
+  DubUserdata *udata = (DubUserdata *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return udata;
+}
+
+void dub::gcaccount(lua_State *L, int idx, size_t size) {
+  DubUserdata *udata = superudata(L, idx);
+  if (udata) gcaccount(L, udata, size);
+}
+
+dub::SharedUserdata *dub::toshared(lua_State *L, int narg) {
+  DubUserdata *udata = superudata(L, narg);
+  if (udata && udata->shared) {
+    return static_cast<SharedUserdata*>(udata);
+  }
+  return NULL;
+}
+
+void dub::pushstats(lua_State *L, const GcStats &stats) {
+  lua_createtable(L, 0, 4);
+  lua_pushnumber(L, stats.bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushnumber(L, stats.peak);
+  lua_setfield(L, -2, "peak");
+  lua_pushnumber(L, stats.objects);
+  lua_setfield(L, -2, "objects");
+  lua_pushnumber(L, stats.steps);
+  lua_setfield(L, -2, "steps");
+}
+
+int dub::gcstats(lua_State *L) {
+  GcStats *stats = getgcstats(L, true);
+  pushstats(L, *stats);
+  return 1;
+}
+
+// ======================================================================
+// =============================================== dub::ClassStats
+// ======================================================================
+
+#ifdef _MSC_VER
+#ifdef _WIN64
+#define dub_atomic_add(ptr, val) _InterlockedExchangeAdd64((volatile __int64 *)(ptr), (__int64)(val))
+#else
+#define dub_atomic_add(ptr, val) _InterlockedExchangeAdd((volatile long *)(ptr), (long)(val))
+#endif
+#else
+#define dub_atomic_add(ptr, val) __sync_fetch_and_add(ptr, val)
+#endif
+
+// All the statistics (linked on static initialization).
+static dub::ClassStats *class_stats = NULL;
+
+dub::ClassStats::ClassStats(const char *name, size_t size)
+  : name_(name)
+  , size_(size)
+  , live_(0)
+  , created_(0)
+  , owned_(0)
+  , borrowed_(0)
+  , next_(class_stats) {
+  class_stats = this;
+}
+
+void dub::ClassStats::add(lua_State *L, int idx) {
+  DubUserdata *udata = superudata(L, idx);
+  if (!udata || udata->counted) return;
+  udata->counted = true;
+  dub_atomic_add(&live_, 1);
+  dub_atomic_add(&created_, 1);
+}
+
+void dub::ClassStats::remove(DubUserdata *udata) {
+  if (udata->gc || udata->counted) {
+    dub_atomic_add(&owned_, 1);
+  } else {
+    dub_atomic_add(&borrowed_, 1);
+  }
+  if (udata->counted) {
+    udata->counted = false;
+    dub_atomic_add(&live_, (size_t)-1);
+  }
+}
+
+const dub::ClassStats *dub::ClassStats::first() {
+  return class_stats;
+}
+
+const dub::ClassStats *dub::ClassStats::find(const char *name) {
+  for (const ClassStats *stats = class_stats; stats; stats = stats->next_) {
+    if (!strcmp(stats->name_, name)) return stats;
+  }
+  return NULL;
+}
+
+void dub::pushstats(lua_State *L, const ClassStats &stats) {
+  lua_createtable(L, 0, 5);
+  lua_pushnumber(L, stats.live());
+  lua_setfield(L, -2, "live");
+  lua_pushnumber(L, stats.created());
+  lua_setfield(L, -2, "created");
+  lua_pushnumber(L, stats.owned());
+  lua_setfield(L, -2, "owned");
+  lua_pushnumber(L, stats.borrowed());
+  lua_setfield(L, -2, "borrowed");
+  lua_pushnumber(L, stats.bytes());
+  lua_setfield(L, -2, "bytes");
+}
+
+int dub::stats(lua_State *L) {
+  lua_newtable(L);
+  for (const ClassStats *stats = ClassStats::first(); stats; stats = stats->next()) {
+    pushstats(L, *stats);
+    lua_setfield(L, -2, stats->name());
+  }
+  return 1;
+}
+
+// ======================================================================
+// =============================================== sequences
+// ======================================================================
+
+size_t dub::rawlen(lua_State *L, int idx) {
+  return dub_rawlen(L, idx);
+}
+
+// ======================================================================
+// =============================================== container views
+// ======================================================================
+
+void dub::pushview(lua_State *L, const void *ptr, const Type &type) {
+  const void **udata = (const void**)lua_newuserdata(L, sizeof(void*));
+  *udata = ptr;
+  pushmetatable(L, type);
+  // <udata> <mt>
+  lua_setmetatable(L, -2);
+}
+
+int dub::readonlyview(lua_State *L) {
+  return luaL_error(L, "cannot modify read-only container");
+}
+
+// ======================================================================
+// =============================================== ranges
+// ======================================================================
+
+#define DUB_RANGE_MT "dub.Range"
+
+static int range_gc(lua_State *L) {
+  dub::Range *r = (dub::Range*)lua_touserdata(L, 1);
+  r->~Range();
+  return 0;
+}
+
+int dub::rangenext(lua_State *L) {
+  // The cursor is the upvalue set by pushrange so the step does not need
+  // to check the state argument.
+  dub::Range *r = (dub::Range*)lua_touserdata(L, lua_upvalueindex(1));
+  return r->next(L);
+}
+
+void dub::setrange(lua_State *L) {
+  if (luaL_newmetatable(L, DUB_RANGE_MT)) {
+    // <cursor> <mt>
+    lua_pushcfunction(L, range_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+}
+
+// ======================================================================
+// =============================================== dub::Buffer
+// ======================================================================
+
+#define DUB_BUFFER_MT "dub.Buffer"
+
+const char *dub::Buffer::ctype(ElemType type) {
+  switch (type) {
+    case Int8:   return "int8_t";
+    case UInt8:  return "uint8_t";
+    case Int16:  return "int16_t";
+    case UInt16: return "uint16_t";
+    case Int32:  return "int32_t";
+    case UInt32: return "uint32_t";
+    case Float:  return "float";
+    default:     return "double";
+  }
+}
+
+size_t dub::Buffer::elemsize(ElemType type) {
+  switch (type) {
+    case Int8:
+    case UInt8:  return 1;
+    case Int16:
+    case UInt16: return 2;
+    case Int32:
+    case UInt32: return 4;
+    case Float:  return sizeof(float);
+    default:     return sizeof(double);
+  }
+}
+
+dub::Buffer *dub::checkbuffer(lua_State *L, int narg) {
+  return (dub::Buffer*)luaL_checkudata(L, narg, DUB_BUFFER_MT);
+}
+
+static void buffer_push(lua_State *L, const dub::Buffer *b, size_t i) {
+  const char *p = (const char*)b->data + i * b->stride;
+  switch (b->type) {
+    case dub::Buffer::Int8:   lua_pushinteger(L, *(const signed char*)p);    break;
+    case dub::Buffer::UInt8:  lua_pushinteger(L, *(const unsigned char*)p);  break;
+    case dub::Buffer::Int16:  lua_pushinteger(L, *(const short*)p);          break;
+    case dub::Buffer::UInt16: lua_pushinteger(L, *(const unsigned short*)p); break;
+    case dub::Buffer::Int32:  lua_pushinteger(L, *(const int*)p);            break;
+    case dub::Buffer::UInt32: lua_pushnumber(L, *(const unsigned int*)p);    break;
+    case dub::Buffer::Float:  lua_pushnumber(L, *(const float*)p);           break;
+    default:                  lua_pushnumber(L, *(const double*)p);          break;
+  }
+}
+
+static void buffer_set(dub::Buffer *b, size_t i, lua_Number v) {
+  char *p = (char*)b->data + i * b->stride;
+  switch (b->type) {
+    case dub::Buffer::Int8:   *(signed char*)p    = (signed char)v;    break;
+    case dub::Buffer::UInt8:  *(unsigned char*)p  = (unsigned char)v;  break;
+    case dub::Buffer::Int16:  *(short*)p          = (short)v;          break;
+    case dub::Buffer::UInt16: *(unsigned short*)p = (unsigned short)v; break;
+    case dub::Buffer::Int32:  *(int*)p            = (int)v;            break;
+    case dub::Buffer::UInt32: *(unsigned int*)p   = (unsigned int)v;   break;
+    case dub::Buffer::Float:  *(float*)p          = (float)v;          break;
+    default:                  *(double*)p         = (double)v;         break;
+  }
+}
+
+static int buffer_index(lua_State *L) {
+  dub::Buffer *b = (dub::Buffer*)lua_touserdata(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = lua_tointeger(L, 2);
+    if (i < 1 || (size_t)i > b->len) return 0;
+    buffer_push(L, b, (size_t)i - 1);
+    return 1;
+  }
+  // Method
+  lua_getmetatable(L, 1);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, -2);
+  return 1;
+}
+
+static int buffer_newindex(lua_State *L) {
+  dub::Buffer *b = (dub::Buffer*)lua_touserdata(L, 1);
+  if (b->readonly) {
+    return luaL_error(L, "cannot modify read-only buffer");
+  }
+  lua_Integer i = luaL_checkinteger(L, 2);
+  lua_Number v = luaL_checknumber(L, 3);
+  if (i < 1 || (size_t)i > b->len) {
+    return luaL_error(L, "index %d out of range", (int)i);
+  }
+  buffer_set(b, (size_t)i - 1, v);
+  return 0;
+}
+
+static int buffer_len(lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)((dub::Buffer*)lua_touserdata(L, 1))->len);
+  return 1;
+}
+
+static int buffer_tostring(lua_State *L) {
+  dub::Buffer *b = (dub::Buffer*)lua_touserdata(L, 1);
+  lua_pushfstring(L, "dub.Buffer<%s>[%d]: %p", dub::Buffer::ctype(b->type), (int)b->len, b->data);
+  return 1;
+}
+
+// b:getbytes([first, last])
+static int buffer_getbytes(lua_State *L) {
+  dub::Buffer *b = dub::checkbuffer(L, 1);
+  lua_Integer first = luaL_optinteger(L, 2, 1);
+  lua_Integer last  = luaL_optinteger(L, 3, (lua_Integer)b->len);
+  if (first < 1 || last > (lua_Integer)b->len || first > last + 1) return 0;
+  size_t n = (size_t)(last - first + 1);
+  size_t sz = dub::Buffer::elemsize(b->type);
+  const char *p = (const char*)b->data + (first - 1) * b->stride;
+  if (b->stride == sz) {
+    lua_pushlstring(L, p, n * sz);
+  } else {
+    std::string bytes;
+    bytes.reserve(n * sz);
+    for (size_t i = 0; i < n; ++i) {
+      bytes.append(p + i * b->stride, sz);
+    }
+    lua_pushlstring(L, bytes.data(), bytes.size());
+  }
+  return 1;
+}
+
+// b:setbytes(s [, first])
+static int buffer_setbytes(lua_State *L) {
+  dub::Buffer *b = dub::checkbuffer(L, 1);
+  size_t len;
+  const char *s = luaL_checklstring(L, 2, &len);
+  lua_Integer first = luaL_optinteger(L, 3, 1);
+  size_t sz = dub::Buffer::elemsize(b->type);
+  if (b->readonly) {
+    return luaL_error(L, "cannot modify read-only buffer");
+  }
+  if (len % sz) {
+    return luaL_error(L, "string length %d is not a multiple of %d", (int)len, (int)sz);
+  }
+  size_t n = len / sz;
+  if (first < 1 || (size_t)first - 1 + n > b->len) {
+    return luaL_error(L, "%d elements from index %d do not fit in buffer", (int)n, (int)first);
+  }
+  char *p = (char*)b->data + (first - 1) * b->stride;
+  if (b->stride == sz) {
+    memcpy(p, s, len);
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      memcpy(p + i * b->stride, s + i * sz, sz);
+    }
   }
+  return 0;
 }
 
-void Thread::dub_pushvalue(const char *name) const {
-  lua_State *L = const_cast<lua_State *>(dub_L);
-  lua_getfield(L, 1, name);
+static int buffer_ptr(lua_State *L) {
+  lua_pushlightuserdata(L, dub::checkbuffer(L, 1)->data);
+  return 1;
 }
 
-bool Thread::dub_call(int param_count, int retval_count) const {
-  lua_State *L = const_cast<lua_State *>(dub_L);
-  int status = lua_pcall(L, param_count, retval_count, 2);
-  if (status) {
-    if (status == LUA_ERRRUN) {
-      // failure properly handled by the error handler
-    } else if (status == LUA_ERRMEM) {
-      // memory allocation failure
-      fprintf(stderr, "Memory allocation failure (%s).\n", lua_tostring(dub_L, -1));
-    } else {
-      // error in error handler
-      fprintf(stderr, "Error in error handler (%s).\n", lua_tostring(dub_L, -1));
-    }
-    lua_pop(dub_L, 1);
-    return false;
-  }
-  return true;
+static int buffer_ctype(lua_State *L) {
+  lua_pushstring(L, dub::Buffer::ctype(dub::checkbuffer(L, 1)->type));
+  return 1;
 }
 
+static int buffer_stride(lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)dub::checkbuffer(L, 1)->stride);
+  return 1;
+}
 
-
+static const luaL_Reg buffer_methods[] = {
+  { "__index"   , buffer_index    },
+  { "__newindex", buffer_newindex },
+  { "__len"     , buffer_len      },
+  { "__tostring", buffer_tostring },
+  { "getbytes"  , buffer_getbytes },
+  { "setbytes"  , buffer_setbytes },
+  { "ptr"       , buffer_ptr      },
+  { "ctype"     , buffer_ctype    },
+  { "stride"    , buffer_stride   },
+  { NULL, NULL},
+};
+
+void dub::pushbuffer(lua_State *L, const void *data, size_t len, Buffer::ElemType type, size_t stride, bool readonly) {
+  dub::Buffer *b = (dub::Buffer*)lua_newuserdata(L, sizeof(dub::Buffer));
+  b->data     = const_cast<void*>(data);
+  b->len      = data ? len : 0;
+  b->stride   = stride;
+  b->type     = type;
+  b->readonly = readonly;
+  if (luaL_newmetatable(L, DUB_BUFFER_MT)) {
+    // <udata> <mt>
+    for (const luaL_Reg *m = buffer_methods; m->name; ++m) {
+      lua_pushcfunction(L, m->func);
+      lua_setfield(L, -2, m->name);
+    }
+  }
+  lua_setmetatable(L, -2);
+}
 
 // ======================================================================
 // =============================================== dub::error
@@ -291,6 +1385,10 @@ bool Thread::dub_call(int param_count, int retval_count) const {
 // This calls lua_Error after preparing the error message with line
 // and number.
 int dub::error(lua_State *L) {
+  if (lua_type(L, -1) == LUA_TUSERDATA) {
+    // dub::Error: location already recorded.
+    return lua_error(L);
+  }
   // ... <msg>
   luaL_where(L, 1);
   // ... <msg> <where>
@@ -310,6 +1408,107 @@ int dub::error(lua_State *L) {
   return lua_error(L);
 }
 
+// ======================================================================
+// =============================================== dub::Error
+// ======================================================================
+
+static int Error___tostring(lua_State *L) {
+  Error *err = (Error*)luaL_checkudata(L, 1, DUB_ERROR_MT);
+  if (err->line > 0) {
+    lua_pushfstring(L, "%s:%d: %s: ", err->where, err->line, err->func);
+  } else {
+    lua_pushfstring(L, "%s: ", err->func);
+  }
+  if (err->format) {
+    lua_pushfstring(L, err->format, err->type, err->found ? err->found : "");
+  } else {
+    lua_pushstring(L, err->message);
+  }
+  lua_concat(L, 2);
+  return 1;
+}
+
+static int Error___index(lua_State *L) {
+  Error *err = (Error*)luaL_checkudata(L, 1, DUB_ERROR_MT);
+  const char *key = luaL_checkstring(L, 2);
+  if (!strcmp(key, "func")) {
+    lua_pushstring(L, err->func);
+  } else if (!strcmp(key, "type") && err->type) {
+    lua_pushstring(L, err->type);
+  } else if (!strcmp(key, "found") && err->found) {
+    lua_pushstring(L, err->found);
+  } else if (!strcmp(key, "narg") && err->narg) {
+    lua_pushinteger(L, err->narg);
+  } else if (!strcmp(key, "message")) {
+    // message without location and function name
+    if (err->format) {
+      lua_pushfstring(L, err->format, err->type, err->found ? err->found : "");
+    } else {
+      lua_pushstring(L, err->message);
+    }
+  } else {
+    lua_pushnil(L);
+  }
+  return 1;
+}
+
+static Error *dub_newerror(lua_State *L, const char *func, size_t msg_len) {
+  Error *err = (Error*)lua_newuserdata(L, sizeof(Error) + msg_len);
+  err->func   = func;
+  err->format = NULL;
+  err->type   = NULL;
+  err->found  = NULL;
+  err->narg   = 0;
+  err->line   = 0;
+  err->message[0] = '\0';
+  // <err>
+  // Same location as luaL_where in dub::error.
+  lua_Debug ar;
+  for (int level = 1; level <= 2 && lua_getstack(L, level, &ar); ++level) {
+    lua_getinfo(L, "Sl", &ar);
+    if (ar.currentline <= 0) break;
+    if (!strncmp(ar.short_src, DUB_INIT_ERR, strlen(DUB_INIT_ERR))) {
+      // error in ctor, show calling place, not dub init code.
+      continue;
+    }
+    err->line = ar.currentline;
+    memcpy(err->where, ar.short_src, LUA_IDSIZE);
+    break;
+  }
+  if (luaL_newmetatable(L, DUB_ERROR_MT)) {
+    // <err> <mt>
+    lua_pushcfunction(L, Error___tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pushcfunction(L, Error___index);
+    lua_setfield(L, -2, "__index");
+  }
+  // <err> <mt>
+  lua_setmetatable(L, -2);
+  // <err>
+  return err;
+}
+
+void dub::pusherror(lua_State *L, const char *func, const std::exception &e) {
+  const Exception *de = dynamic_cast<const Exception*>(&e);
+  if (de && de->format()) {
+    Error *err = dub_newerror(L, func, 0);
+    err->format = de->format();
+    err->type   = de->type();
+    err->found  = de->found();
+    err->narg   = de->narg();
+  } else {
+    const char *msg = e.what();
+    size_t len = strlen(msg);
+    Error *err = dub_newerror(L, func, len);
+    memcpy(err->message, msg, len + 1);
+  }
+}
+
+void dub::pusherror(lua_State *L, const char *func) {
+  Error *err = dub_newerror(L, func, 0);
+  err->format = UNKNOWN_EXCEPTION_MSG;
+}
+
 
 
 
@@ -386,34 +1585,106 @@ void dub::pushudata(lua_State *L, const void *cptr, const char *tname, bool gc)
   void *ptr = const_cast<void*>(cptr);
   // If anything is changed here, it must be reflected in dub::Object::dub_pushobject.
   DubUserdata *userdata = (DubUserdata*)lua_newuserdata(L, sizeof(DubUserdata));
-  userdata->ptr = ptr;
+  initudata(userdata, ptr, NULL, gc);
   if (!gc) {
     // Point to original (self) to avoid original gc.
     dub::protect(L, lua_gettop(L), 1, "_");
   }
 
-  userdata->gc = gc;
-
   // the userdata is now on top of the stack
   luaL_getmetatable(L, tname);
   if (lua_isnil(L, -1)) {
     lua_pop(L, 1);
     // create empty metatable on the fly for opaque types.
     luaL_newmetatable(L, tname);
+  } else {
+    userdata->type = mttype(L, -1);
+  }
+  // <udata> <mt>
+
+  // set metatable (contains methods)
+  lua_setmetatable(L, -2);
+}
+
+void dub::pushudata(lua_State *L, const void *cptr, const Type &type, bool gc) {
+  // To avoid users spending time with const issues.
+  void *ptr = const_cast<void*>(cptr);
+  // If anything is changed here, it must be reflected in dub::Object::dub_pushobject.
+  DubUserdata *userdata = (DubUserdata*)lua_newuserdata(L, sizeof(DubUserdata));
+  initudata(userdata, ptr, &type, gc);
+  if (!gc) {
+    // Point to original (self) to avoid original gc.
+    dub::protect(L, lua_gettop(L), 1, "_");
   }
+
+  // Metatable resolved on library open (opaque types included).
+  pushmetatable(L, type);
   // <udata> <mt>
 
   // set metatable (contains methods)
   lua_setmetatable(L, -2);
 }
 
+// Push the identity cache for 'type' (created if needed). The cache is
+// stored in the metatable and in the upvalue table (index -slot) for fast
+// access.
+static void pushcache(lua_State *L, const Type &type) {
+  lua_rawgeti(L, lua_upvalueindex(1), -type.slot);
+  if (!lua_isnil(L, -1)) return;
+  lua_pop(L, 1);
+  pushmetatable(L, type);
+  // <mt>
+  lua_pushlstring(L, "_cache_", 7);
+  lua_rawget(L, -2);
+  // <mt> <cache/nil>
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    dub::identity(L);
+    lua_pushlstring(L, "_cache_", 7);
+    lua_rawget(L, -2);
+  }
+  // <mt> <cache>
+  lua_remove(L, -2);
+  lua_pushvalue(L, -1);
+  // <cache> <cache>
+  lua_rawseti(L, lua_upvalueindex(1), -type.slot);
+  // <cache>
+}
+
+void dub::pushcached(lua_State *L, const void *cptr, const Type &type, bool gc) {
+  void *ptr = const_cast<void*>(cptr);
+  pushcache(L, type);
+  // <cache>
+  if (!gc) {
+    lua_pushlightuserdata(L, ptr);
+    lua_rawget(L, -2);
+    // <cache> <udata/nil>
+    DubUserdata *udata = (DubUserdata *)lua_touserdata(L, -1);
+    if (udata && udata->ptr == ptr) {
+      // Known object.
+      lua_remove(L, -2);
+      // <udata>
+      return;
+    }
+    lua_pop(L, 1);
+  }
+  // New object (or new owner): replace cache entry.
+  pushudata(L, ptr, type, gc);
+  // <cache> <udata>
+  lua_pushlightuserdata(L, ptr);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -4); // cache[ptr] = udata
+  lua_remove(L, -2);
+  // <udata>
+}
+
 // ======================================================================
 // =============================================== dub::check ...
 // ======================================================================
 // These methods are slight adaptations from luaxlib.c
 // Copyright (C) 1994-2008 Lua.org, PUC-Rio.
 
-lua_Number dub::checknumber(lua_State *L, int narg) throw(TypeException) {
+lua_Number dub::checknumber(lua_State *L, int narg) DUB_THROW(TypeException) {
 #ifdef DUB_LUA_FIVE_ONE
   lua_Number d = lua_tonumber(L, narg);
   if (d == 0 && !lua_isnumber(L, narg))  /* avoid extra test when d is not 0 */
@@ -428,7 +1699,7 @@ lua_Number dub::checknumber(lua_State *L, int narg) throw(TypeException) {
 #endif
 }
 
-lua_Integer dub::checkinteger(lua_State *L, int narg) throw(TypeException) {
+lua_Integer dub::checkinteger(lua_State *L, int narg) DUB_THROW(TypeException) {
 #ifdef DUB_LUA_FIVE_ONE
   lua_Integer d = lua_tointeger(L, narg);
   if (d == 0 && !lua_isnumber(L, narg))  /* avoid extra test when d is not 0 */
@@ -443,17 +1714,27 @@ lua_Integer dub::checkinteger(lua_State *L, int narg) throw(TypeException) {
 #endif
 }
 
-const char *dub::checklstring(lua_State *L, int narg, size_t *len) throw(TypeException) {
+const char *dub::checklstring(lua_State *L, int narg, size_t *len) DUB_THROW(TypeException) {
   const char *s = lua_tolstring(L, narg, len);
   if (!s) throw TypeException(L, narg, lua_typename(L, LUA_TSTRING));
   return s;
 }
 
-void **dub::checkudata(lua_State *L, int ud, const char *tname, bool keep_mt) throw(dub::Exception) {
+// Push the metatable to compare with: resolved metatable from the upvalue
+// table if 'slot' is set or registry lookup by name.
+static inline void push_check_mt(lua_State *L, const char *tname, int slot) {
+  if (slot) {
+    lua_rawgeti(L, lua_upvalueindex(1), slot);
+  } else {
+    lua_getfield(L, LUA_REGISTRYINDEX, tname);
+  }
+}
+
+static inline void **dub_checkudata(lua_State *L, int ud, const char *tname, int slot, bool keep_mt) DUB_THROW(dub::Exception) {
   void **p = (void**)lua_touserdata(L, ud);
   if (p != NULL) {  /* value is a userdata? */
     if (lua_getmetatable(L, ud)) {  /* does it have a metatable? */
-      lua_getfield(L, LUA_REGISTRYINDEX, tname);  /* get correct metatable */
+      push_check_mt(L, tname, slot);  /* get correct metatable */
       if (lua_rawequal(L, -1, -2)) {
         // same (correct) metatable
         if (!keep_mt) {
@@ -463,7 +1744,7 @@ void **dub::checkudata(lua_State *L, int ud, const char *tname, bool keep_mt) th
           lua_pop(L, 1);
         }
         if (!*p) {
-          throw dub::Exception(DEAD_EXCEPTION_MSG, tname);
+          throw dub::DeadException(tname, ud);
         }
         return p;
       }
@@ -473,46 +1754,66 @@ void **dub::checkudata(lua_State *L, int ud, const char *tname, bool keep_mt) th
   return NULL;  /* to avoid warnings */
 }
 
+void **dub::checkudata(lua_State *L, int ud, const char *tname, bool keep_mt) DUB_THROW(dub::Exception) {
+  return dub_checkudata(L, ud, tname, 0, keep_mt);
+}
 
-static inline void **dub_cast_ud(lua_State *L, int ud, const char *tname) {
-  // .. <ud> ... <mt> <mt>
-  lua_pop(L, 1);
-  // ... <ud> ... <mt>
-  // TODO: optmize by putting this cast value in the registry.
-  lua_pushlstring(L, "_cast_", 6);
-  // ... <ud> ... <mt> "_cast_"
-  lua_rawget(L, -2);
-  if (lua_isfunction(L, -1)) {
-    lua_pushvalue(L, ud);
-    lua_pushstring(L, tname);
-    // ... <ud> ... <mt> cast_func <ud> "OtherType"
-    lua_call(L, 2, 1);
-    // ... <ud> ... <mt> <ud>
-    void **p = (void**)lua_touserdata(L, -1);
-    if (p != NULL) {
-      // done
-      return p;
+void *dub::checkudata(lua_State *L, int ud, const Type &type, bool keep_mt) DUB_THROW(dub::Exception) {
+  if (lua_istable(L, ud)) {
+    throw TypeException(L, ud, type.name);
+  }
+  return dub::checksdata(L, ud, type, keep_mt);
+}
+
+
+// Return the cast to the class 'id' in the zero terminated list of casts.
+static inline const Cast *findcast(const Cast *casts, unsigned int id) {
+  if (casts) {
+    for (; casts->id; ++casts) {
+      if (casts->id == id) return casts;
     }
   }
+  return NULL;
+}
+
+static inline void **dub_cast_ud(lua_State *L, void **p, const char *tname) {
+  // ... <mt> <mt>
+  lua_pop(L, 1);
+  // ... <mt>
+  const Cast *cast = NULL;
+  const Type *type = mttype(L, -1);
+  if (type) {
+    cast = findcast(type->casts, classid(tname));
+  }
+  if (cast) {
+    // The string API returns the address of the pointer: store the cast
+    // pointer in a new userdata.
+    void **cp = (void**)lua_newuserdata(L, sizeof(void*));
+    *cp = *p ? cast->cast(*p) : NULL;
+    // ... <mt> <cp>
+    return cp;
+  }
 
-  // ... <ud> ... <mt> nil
+  lua_pushnil(L);
+  // ... <mt> nil
   // Does not change stack size (only last element).
   return NULL;
 }
 
-static inline void **getsdata(lua_State *L, int ud, const char *tname, bool keep_mt) throw() {
+static inline void **getsdata(lua_State *L, int ud, const char *tname, int slot, bool keep_mt) DUB_NOTHROW {
   void **p = (void**)lua_touserdata(L, ud);
   if (p != NULL) {  /* value is a userdata? */
     if (lua_getmetatable(L, ud)) {  /* does it have a metatable? */
-      lua_getfield(L, LUA_REGISTRYINDEX, tname);  /* get correct metatable */
+      push_check_mt(L, tname, slot);  /* get correct metatable */
       if (lua_rawequal(L, -1, -2)) {
         // same (correct) metatable
         lua_pop(L, keep_mt ? 1 : 2);
       } else {
-        p = dub_cast_ud(L, ud, tname);
-        // ... <ud> ... <ud> <mt/nil>
+        p = dub_cast_ud(L, p, tname);
+        // ... <ud> ... <mt> <ud/nil>
         if (p && keep_mt) {
-          lua_remove(L, -2);
+          // keep <mt>
+          lua_pop(L, 1);
         } else {
           lua_pop(L, 2);
         }
@@ -534,7 +1835,7 @@ static inline void **getsdata(lua_State *L, int ud, const char *tname, bool keep
       // ... <ud> ... <ud>
       if (lua_getmetatable(L, -1)) {  /* does it have a metatable? */
         // ... <ud> ... <ud> <mt>
-        lua_getfield(L, LUA_REGISTRYINDEX, tname);  /* get correct metatable */
+        push_check_mt(L, tname, slot);  /* get correct metatable */
         // ... <ud> ... <ud> <mt> <mt>
         if (lua_rawequal(L, -1, -2)) {
           // same (correct) metatable
@@ -544,10 +1845,10 @@ static inline void **getsdata(lua_State *L, int ud, const char *tname, bool keep
         } else {
           lua_remove(L, -3);
           // ... <ud> ... <mt> <mt>
-          p = dub_cast_ud(L, ud, tname);
-          // ... <ud> ... <ud> <mt/nil>
+          p = dub_cast_ud(L, p, tname);
+          // ... <ud> ... <mt> <ud/nil>
           if (p && keep_mt) {
-            lua_remove(L, -2);
+            lua_pop(L, 1);
             // ... <ud> ... <mt>
           } else {
             lua_pop(L, 2);
@@ -566,8 +1867,84 @@ static inline void **getsdata(lua_State *L, int ud, const char *tname, bool keep
   return p;
 }
 
-void **dub::checksdata_n(lua_State *L, int ud, const char *tname, bool keep_mt) {
-  void **p = getsdata(L, ud, tname, keep_mt);
+// Return the dub header of the userdata at index 'ud' or NULL if the value is
+// not a userdata created by dub. The header is only trusted if the metatable
+// was setup by dub (it holds the class type which is returned in 'mt_type'):
+// the magic number alone could match the bytes of a foreign userdata.
+static inline DubUserdata *toudata(lua_State *L, int ud, const Type **mt_type) {
+  DubUserdata *udata = (DubUserdata*)lua_touserdata(L, ud);
+  if (udata &&
+      dub_rawlen(L, ud) >= sizeof(DubUserdata) &&
+      udata->magic == DUB_UDATA_MAGIC &&
+      lua_getmetatable(L, ud)) {
+    *mt_type = mttype(L, -1);
+    lua_pop(L, 1);
+    if (*mt_type) return udata;
+  }
+  return NULL;
+}
+
+// Typed version of getsdata: exact type and inheritance are decided by
+// comparing class ids in the userdata header and the object pointer is cast
+// with the type's cast table. Returns the address of the pointer stored in
+// the userdata (or NULL on type mismatch) and sets 'ptr' to the cast object
+// pointer. Falls back to metatable comparison for userdata without typed
+// header or with a metatable not setup by dub (class not loaded yet).
+static inline void **getsdata(lua_State *L, int ud, const Type &type, bool keep_mt, void **ptr) DUB_NOTHROW {
+  int idx = ud;
+  bool is_super = false;
+  if (lua_istable(L, ud)) {
+    // get p from super
+    // ... <ud> ...
+    lua_pushlstring(L, "super", 5);
+    // ... <ud> ... 'super'
+    lua_rawget(L, ud < 0 ? ud - 1 : ud);
+    // ... <ud> ... <ud?>
+    idx = -1;
+    is_super = true;
+  }
+
+  const Type *mt_type = NULL;
+  DubUserdata *udata = toudata(L, idx, &mt_type);
+  const Type *t = udata ? udata->type : NULL;
+  if (t && t->id != type.id && !t->casts) {
+    // Pushed from a binding file where the super classes are not known: use
+    // the type registered by the class bindings.
+    t = mt_type;
+  }
+
+  if (t) {
+    void **p = NULL;
+    if (t->id == type.id) {
+      // exact type
+      p = &udata->ptr;
+      *ptr = udata->ptr;
+    } else {
+      const Cast *cast = findcast(t->casts, type.id);
+      if (cast) {
+        // sub-class
+        p = &udata->ptr;
+        *ptr = udata->ptr ? cast->cast(udata->ptr) : NULL;
+      }
+    }
+    if (p && keep_mt) {
+      lua_getmetatable(L, idx);
+      // ... <ud> ... [<ud>] <mt>
+      if (is_super) lua_remove(L, -2);
+    } else if (is_super) {
+      lua_pop(L, 1);
+    }
+    return p;
+  }
+
+  if (is_super) lua_pop(L, 1);
+  // Userdata without typed header: compare metatables.
+  void **p = getsdata(L, ud, type.name, type.slot, keep_mt);
+  if (p) *ptr = *p;
+  return p;
+}
+
+static inline void **dub_checksdata_n(lua_State *L, int ud, const char *tname, void **p) {
   if (!p) {
     luaL_error(L, TYPE_EXCEPTION_MSG, tname, luaL_typename(L, ud));
   } else if (!*p) {
@@ -577,35 +1954,79 @@ void **dub::checksdata_n(lua_State *L, int ud, const char *tname, bool keep_mt)
   return p;
 }
 
+void **dub::checksdata_n(lua_State *L, int ud, const char *tname, bool keep_mt) {
+  return dub_checksdata_n(L, ud, tname, getsdata(L, ud, tname, 0, keep_mt));
+}
+
+void *dub::checksdata_n(lua_State *L, int ud, const Type &type, bool keep_mt) {
+  void *ptr = NULL;
+  dub_checksdata_n(L, ud, type.name, getsdata(L, ud, type, keep_mt, &ptr));
+  return ptr;
+}
+
+static inline void **dub_issdata(const char *tname, void **p) {
+  if (!p) {
+    return NULL;
+  } else if (!*p) {
+    // dead object
+    throw dub::DeadException(tname);
+  } else {
+    return p;
+  }
+}
+
 void **dub::issdata(lua_State *L, int ud, const char *tname, int type) {
   if (type == LUA_TUSERDATA || type == LUA_TTABLE) {
-    void **p = getsdata(L, ud, tname, false);
-    if (!p) {
-      return NULL;
-    } else if (!*p) {
+    return dub_issdata(tname, getsdata(L, ud, tname, 0, false));
+  } else {
+    return NULL;
+  }
+}
+
+void *dub::issdata(lua_State *L, int ud, const Type &type, int type_id) {
+  if (type_id == LUA_TUSERDATA || type_id == LUA_TTABLE) {
+    void *ptr = NULL;
+    return dub_issdata(type.name, getsdata(L, ud, type, false, &ptr)) ? ptr : NULL;
+  } else {
+    return NULL;
+  }
+}
+
+void *dub::issdata_n(lua_State *L, int ud, const Type &type, int type_id) {
+  if (type_id == LUA_TUSERDATA || type_id == LUA_TTABLE) {
+    void *ptr = NULL;
+    void **p = getsdata(L, ud, type, false, &ptr);
+    if (p && !*p) {
       // dead object
-      throw dub::Exception(DEAD_EXCEPTION_MSG, tname);
-    } else {
-      return p;
+      luaL_error(L, DEAD_EXCEPTION_MSG, type.name);
     }
+    return p ? ptr : NULL;
   } else {
     return NULL;
   }
 }
 
-void **dub::checksdata(lua_State *L, int ud, const char *tname, bool keep_mt) throw(dub::Exception) {
-  void **p = getsdata(L, ud, tname, keep_mt);
+static inline void **dub_checksdata(lua_State *L, int ud, const char *tname, void **p) DUB_THROW(dub::Exception) {
   if (!p) {
     throw dub::TypeException(L, ud, tname);
   } else if (!*p) {
     // dead object
-    throw dub::Exception(DEAD_EXCEPTION_MSG, tname);
+    throw dub::DeadException(tname, ud);
   }
   return p;
 }
 
-void **dub::checksdata_d(lua_State *L, int ud, const char *tname) throw(dub::Exception) {
-  void **p = getsdata(L, ud, tname, false);
+void **dub::checksdata(lua_State *L, int ud, const char *tname, bool keep_mt) DUB_THROW(dub::Exception) {
+  return dub_checksdata(L, ud, tname, getsdata(L, ud, tname, 0, keep_mt));
+}
+
+void *dub::checksdata(lua_State *L, int ud, const Type &type, bool keep_mt) DUB_THROW(dub::Exception) {
+  void *ptr = NULL;
+  dub_checksdata(L, ud, type.name, getsdata(L, ud, type, keep_mt, &ptr));
+  return ptr;
+}
+
+static inline void **dub_checksdata_d(lua_State *L, int ud, const char *tname, void **p) DUB_THROW(dub::Exception) {
   if (!p) {
     throw dub::TypeException(L, ud, tname);
   }
@@ -613,6 +2034,25 @@ void **dub::checksdata_d(lua_State *L, int ud, const char *tname) throw(dub::Exc
   return p;
 }
 
+void **dub::checksdata_d(lua_State *L, int ud, const char *tname) DUB_THROW(dub::Exception) {
+  return dub_checksdata_d(L, ud, tname, getsdata(L, ud, tname, 0, false));
+}
+
+DubUserdata *dub::checksdata_d(lua_State *L, int ud, const Type &type) DUB_THROW(dub::Exception) {
+  void *ptr = NULL;
+  return (DubUserdata*)dub_checksdata_d(L, ud, type.name, getsdata(L, ud, type, false, &ptr));
+}
+
+DubUserdata *dub::checksdata_dn(lua_State *L, int ud, const Type &type) {
+  void *ptr = NULL;
+  void **p = getsdata(L, ud, type, false, &ptr);
+  if (!p) {
+    luaL_error(L, TYPE_EXCEPTION_MSG, type.name, luaL_typename(L, ud));
+  }
+  // do not check for dead objects
+  return (DubUserdata*)p;
+}
+
 // ======================================================================
 // =============================================== dub::setup
 // ======================================================================
@@ -672,6 +2112,80 @@ void dub::setup(lua_State *L, const char *type_name) {
   // <mt>
 }
 
+void dub::identity(lua_State *L) {
+  // <mt>
+  lua_pushlstring(L, "_cache_", 7);
+  lua_newtable(L);
+  // <mt> "_cache_" <cache>
+  lua_newtable(L);
+  lua_pushlstring(L, "v", 1);
+  lua_setfield(L, -2, "__mode");
+  // <mt> "_cache_" <cache> <weak>
+  lua_setmetatable(L, -2);
+  lua_rawset(L, -3); // mt._cache_ = cache
+  // <mt>
+}
+
+void dub::luaindex(lua_State *L) {
+  // <mt>
+  /*
+  local mt = ...
+  local get = mt.__index
+  mt.__index = function(self, key)
+    -- mt has no metatable: this is a plain table lookup.
+    local m = mt[key]
+    if m ~= nil then return m end
+    return get(self, key)
+  end
+  */
+  int error = luaL_loadbuffer(L, DUB_INDEX_CODE, strlen(DUB_INDEX_CODE), "Dub index code");
+  if (!error) {
+    // <mt> <func>
+    lua_pushvalue(L, -2);
+    // <mt> <func> <mt>
+    error = lua_pcall(L, 1, 0, 0);
+  }
+  if (error) {
+    fprintf(stderr, "%s", lua_tostring(L, -1));
+    lua_pop(L, 1);  /* pop error message from the stack */
+  }
+  // <mt>
+}
+
+void dub::setup(lua_State *L, const Type &type) {
+  // <mt>
+  lua_pushlightuserdata(L, const_cast<Type *>(&type));
+  // <mt> <type>
+  lua_setfield(L, -2, "_type_");
+  // <mt>
+  setup(L, type.name);
+}
+
+const Type *dub::mttype(lua_State *L, int mt) {
+  // ... <mt> ...
+  if (!lua_istable(L, mt)) {
+    // Class not loaded yet.
+    return NULL;
+  }
+  lua_pushlstring(L, "_type_", 6);
+  // ... <mt> ... "_type_"
+  lua_rawget(L, mt < 0 ? mt - 1 : mt);
+  // ... <mt> ... <type/nil>
+  const Type *type = (const Type *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return type;
+}
+
+unsigned int dub::classid(const char *name) {
+  unsigned int h = 0;
+  unsigned char c;
+
+  while ( (c = (unsigned char)*name++) ) {
+    h = c + (h << 6) + (h << 16) - h;
+  }
+  return h;
+}
+
 int dub::hash(const char *str, int sz) {
   unsigned int h = 0;
   int c;
@@ -723,4 +2237,115 @@ void dub::fregister(lua_State *L, const luaL_Reg *l) {
 #endif
 }
 
+int dub::keyindex_s(lua_State *L, int idx) {
+  size_t len;
+  lua_tolstring(L, idx, &len);
+  if (len <= DUB_MAXSHORTLEN) {
+    // Interned string not in KeyIndex.
+    return 0;
+  }
+  lua_pushvalue(L, idx);
+  lua_rawget(L, lua_upvalueindex(1));
+  int i = (int)lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  return i;
+}
+
+void dub::fregister(lua_State *L, const luaL_Reg *l, const Type *types, const char *const *keys) {
+  // <lib>
+  lua_getfield(L, LUA_REGISTRYINDEX, DUB_TYPE_IDS);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, DUB_TYPE_IDS);
+  }
+  // <lib> <ids>
+  for (const Type *t = types; t->name; ++t) {
+    lua_pushnumber(L, t->id);
+    lua_rawget(L, -2);
+    // <lib> <ids> <name/nil>
+    if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      lua_pushnumber(L, t->id);
+      lua_pushstring(L, t->name);
+      lua_rawset(L, -3); // ids[id] = name
+    } else {
+      if (strcmp(lua_tostring(L, -1), t->name)) {
+        luaL_error(L, "Type id collision between '%s' and '%s'.", lua_tostring(L, -1), t->name);
+      }
+      lua_pop(L, 1);
+    }
+    // <lib> <ids>
+  }
+  lua_pop(L, 1);
+
+  // <lib>
+  lua_newtable(L);
+  // <lib> <types>
+  for (; types->name; ++types) {
+    if (types->methods) {
+      // Metatable private to this library (container views).
+      lua_newtable(L);
+      for (const luaL_Reg *m = types->methods; m->name; ++m) {
+        lua_pushcfunction(L, m->func);
+        lua_setfield(L, -2, m->name);
+      }
+    } else {
+      // Get metatable or create an empty metatable for opaque types (or
+      // types bound after this library is opened).
+      luaL_newmetatable(L, types->name);
+    }
+    // <lib> <types> <mt>
+    lua_rawseti(L, -2, types->slot);
+    // <lib> <types>
+  }
+  int nup = 1;
+  if (keys) {
+    size_t count = 0;
+    while (keys[count]) ++count;
+    size_t sz = 2;
+    while (sz < 2 * count) sz *= 2;
+    KeyIndex *ki = (KeyIndex*)lua_newuserdata(L, sizeof(KeyIndex) + (sz - 1) * sizeof(KeyIndex::Slot));
+    ki->mask = sz - 1;
+    for (size_t i = 0; i < sz; ++i) {
+      ki->slots[i].key = NULL;
+      ki->slots[i].index = 0;
+    }
+    // <lib> <types> <ki>
+    for (size_t i = 0; i < count; ++i) {
+      lua_pushstring(L, keys[i]);
+      // Anchor interned string in <types>: types[name] = i.
+      lua_pushvalue(L, -1);
+      lua_pushinteger(L, i + 1);
+      lua_rawset(L, -5);
+      // <lib> <types> <ki> "name"
+      const char *key = lua_tostring(L, -1);
+      size_t h = ((size_t)key >> 3) & ki->mask;
+      while (ki->slots[h].key) h = (h + 1) & ki->mask;
+      ki->slots[h].key = key;
+      ki->slots[h].index = i + 1;
+      lua_pop(L, 1);
+    }
+    nup = 2;
+  }
+  // <lib> <types> [<keys>]
+#ifdef DUB_LUA_FIVE_ONE
+  for (; l->name; ++l) {
+    for (int i = 0; i < nup; ++i) {
+      lua_pushvalue(L, -nup);
+    }
+    // <lib> <types> [<keys>] <types> [<keys>]
+    lua_pushcclosure(L, l->func, nup);
+    // <lib> <types> [<keys>] <func>
+    lua_setfield(L, -2 - nup, l->name);
+    // <lib> <types> [<keys>]
+  }
+  lua_pop(L, nup);
+#else
+  luaL_setfuncs(L, l, nup);
+#endif
+  // <lib>
+}
+
 
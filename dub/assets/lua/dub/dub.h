@@ -31,16 +31,21 @@
 
 #include <string.h>  // strlen strcmp
 
-#ifndef DUB_ASSERT_KEY
-#define DUB_ASSERT_KEY(k, m) strcmp(k, m)
-// Use this to avoid the overhead of strcmp in get/set of public attributes.
-// if you avoid strcmp, bad keys can map to any other key.
-//#define DUB_ASSERT_KEY(k, m) false
-#endif
 #define KEY_EXCEPTION_MSG "invalid key '%s'"
+#define DUB_EXCEPTION_BUFFER_SIZE 256
 
 typedef int LuaStackSize;
 
+// Exception specifications. Dynamic specifications are deprecated in C++11
+// and removed in C++17.
+#if __cplusplus >= 201103L
+#define DUB_THROW(e)
+#define DUB_NOTHROW noexcept
+#else
+#define DUB_THROW(e) throw(e)
+#define DUB_NOTHROW throw()
+#endif
+
 #ifndef DUB_EXPORT
 #ifdef _WIN32
 #define DUB_EXPORT extern "C" __declspec(dllexport)
@@ -59,34 +64,154 @@ extern "C" {
 }
 #endif
 
-#include <string>    // std::string for Exception
+#include <string>    // std::string
 #include <exception> // std::exception
+#include <new>       // placement new for inline storage
+#include <vector>    // std::vector for array parameters
+#if __cplusplus >= 201703L
+#include <string_view> // std::string_view parameters
+#endif
+
+// std::shared_ptr parameters and return values need C++11.
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1600)
+#define DUB_SHARED_PTR
+#include <memory>    // std::shared_ptr
+#endif
 
 // Helpers to check for explicit 'false' or 'true' return values.
 #define lua_isfalse(L,i) (lua_isboolean(L,i) && !lua_toboolean(L,i))
 #define lua_istrue(L,i)  (lua_isboolean(L,i) && lua_toboolean(L,i))
 #define luaL_checkboolean(L,n) (lua_toboolean(L,n))
 
+// Value of DubUserdata.magic for userdata created by dub (24 bits).
+#define DUB_UDATA_MAGIC 0xd0b5a1
+
+namespace dub {
+struct Type;
+} // dub
+
+/** Header of all userdata created by dub. The type and magic fields are used
+ * for type checks without metatable comparison (see dub::Type). They are
+ * only trusted if the metatable was setup by dub. The flags
+ * are packed with the magic number in a single word so that the header takes
+ * 24 bytes on 64 bit platforms (the type pointer is the only addition to the
+ * object pointer and gc flag).
+ */
 struct DubUserdata {
   void *ptr;
-  bool gc;
+  // Type used when pushing the userdata (NULL for opaque types).
+  const dub::Type *type;
+  unsigned int magic   : 24;
+  unsigned int gc      : 1;
+  // Object counted in the statistics of its class (see dub::ClassStats).
+  unsigned int counted : 1;
+  // Object held by a std::shared_ptr stored in the userdata (see
+  // dub::pushshared).
+  unsigned int shared  : 1;
+  // Object allocated in the pool of its class (see dub::ClassPool).
+  unsigned int pooled  : 1;
+  // Native memory reported to the Lua collector in bytes, saturated to 32
+  // bits (see dub::gcaccount).
+  unsigned int gcsize;
 };
 
+namespace dub {
+
+// ======================================================================
+// =============================================== dub::Type
+// ======================================================================
+
+/** Cast from a class to one of its super classes.
+ */
+struct Cast {
+  /** Super class id.
+   */
+  unsigned int id;
+
+  /** Return the pointer to the super class from a pointer to the class.
+   */
+  void *(*cast)(void *ptr);
+};
+
+/** Description of a type used by generated bindings. Each binding file
+ * declares the list of types it uses (terminated by a NULL name). This list
+ * is resolved to metatables once per lua_State when the library is opened
+ * (see dub::fregister) and the result is stored as first upvalue of all
+ * bound functions. Type checks and pushes using a dub::Type do not need a
+ * registry lookup by name.
+ */
+struct Type {
+  /** Metatable name in the registry.
+   */
+  const char *name;
+
+  /** Index of the resolved metatable in the upvalue table.
+   */
+  int slot;
+
+  /** Class id (32 bit hash of the metatable name). Type checks compare ids
+   * instead of metatables.
+   */
+  unsigned int id;
+
+  /** Zero terminated list of casts to all super classes. NULL if the super
+   * classes are not known in this binding file (in this case, the type
+   * stored in the metatable by dub::setup is used).
+   */
+  const Cast *casts;
+
+  /** Metamethods of a metatable private to the binding file (container
+   * views, see dub::pushview). The metatable is created when the library
+   * is opened and is not registered by name. NULL for class metatables.
+   */
+  const luaL_Reg *methods;
+};
+
+/** Fill the header of a new userdata.
+ */
+inline void initudata(DubUserdata *udata, void *ptr, const Type *type, bool gc) {
+  udata->ptr   = ptr;
+  udata->type  = type;
+  udata->magic = DUB_UDATA_MAGIC;
+  udata->gc    = gc;
+  udata->counted = false;
+  udata->shared = false;
+  udata->pooled = false;
+  udata->gcsize = 0;
+}
+
 // ======================================================================
 // =============================================== dub::Exception
 // ======================================================================
-namespace dub {
 
 /** All exceptions raised by dub::check.. are instances of this class. All
  * exceptions deriving from std::exception have their message displayed
  * in Lua (through lua_error).
  */
 class Exception : public std::exception {
-  std::string message_;
+protected:
+  // Fixed buffer so that formatting in what() cannot throw.
+  mutable char message_[DUB_EXCEPTION_BUFFER_SIZE];
+  // Lazy message: 'format' with (static) type names. The message is only
+  // formatted when what() is called.
+  const char *format_;
+  const char *type_;
+  const char *found_;
+  int narg_;
+
+  // Used by sub-classes with lazy messages.
+  Exception();
 public:
   explicit Exception(const char *format, ...);
-  ~Exception() throw();
-  const char* what() const throw();
+  ~Exception() DUB_NOTHROW;
+  const char* what() const DUB_NOTHROW;
+
+  // Structured error fields (format is NULL if the message is already
+  // formatted).
+  const char *format() const { return format_; }
+  const char *type() const   { return type_; }
+  const char *found() const  { return found_; }
+  int narg() const           { return narg_; }
 };
 
 class TypeException : public Exception {
@@ -94,6 +219,13 @@ public:
   explicit TypeException(lua_State *L, int narg, const char *type, bool is_super = false);
 };
 
+/** Raised when using an object deleted from C++.
+ */
+class DeadException : public Exception {
+public:
+  explicit DeadException(const char *type, int narg = 0);
+};
+
 /** This class allows an object to be deleted from either C++ or Lua.
  * When Lua deletes the object, dub_destroy is called. When C++ deletes
  * the object, the related userdata is invalidated.
@@ -126,13 +258,44 @@ protected:
   DubUserdata *dub_userdata_;
 };
 
+/** Message posted to a dub::Thread from any OS thread (see
+ * Thread::dub_post). Sub-classes hold the callback arguments and push them
+ * on delivery.
+ */
+class Message {
+public:
+  /** 'ref' is the callback handle returned by Thread::dub_callbackref.
+   */
+  explicit Message(int ref)
+    : ref_(ref)
+    , next_(NULL) {}
+
+  virtual ~Message() {}
+
+  /** Called from the thread owning the lua_State: push the callback
+   * arguments on L and return their count.
+   */
+  virtual int push(lua_State * /*L*/) const { return 0; }
+
+private:
+  friend class Thread;
+  int ref_;
+  Message *next_;
+};
+
 /** This class creates a 'self' table and prepares a thread
  * that can be used for callbacks from C++ to Lua.
  */
 class Thread : public Object {
 public:
   Thread()
-    : dub_L(NULL) {}
+    : dub_L(NULL)
+    , dub_queued_(0)
+    , dub_posted_(NULL) {}
+
+  /** Deletes messages posted but not delivered.
+   */
+  virtual ~Thread();
   /** This is called on object instanciation by dub to create the lua
    * thread, prepare the <self> table and setup metamethods. This is
    * called instead of dub::pushudata.
@@ -152,6 +315,25 @@ public:
   /** Push any lua value from self on the stack.
    */
   void dub_pushvalue(const char *name) const;
+
+  /** Return a handle for key 'name' to use with dub_pushcallback(int) and
+   * dub_pushvalue(int). The interned key is kept by the thread so that
+   * calls with the handle do not hash 'name' again. Only the key is cached:
+   * the value is read from <self> on every call so that reassigning the
+   * callback from Lua is always seen. Must be called after the object is
+   * pushed.
+   */
+  int dub_callbackref(const char *name);
+
+  /** Same as dub_pushcallback(const char *) with a handle returned by
+   * dub_callbackref.
+   */
+  bool dub_pushcallback(int ref) const;
+
+  /** Same as dub_pushvalue(const char *) with a handle returned by
+   * dub_callbackref.
+   */
+  void dub_pushvalue(int ref) const;
   
   /** Execute the protected call. If an error occurs, dub tries to find
    * an 'error' function in <self> and calls this function with the
@@ -160,6 +342,32 @@ public:
    */
   bool dub_call(int param_count, int retval_count) const;
 
+  /** Queue a call to callback 'ref' (see dub_callbackref) with the
+   * 'param_count' values on top of dub_L as arguments (do not push <func>
+   * and <self>). The values are popped. Queued calls are only executed on
+   * dub_flush.
+   */
+  void dub_queuecallback(int ref, int param_count);
+
+  /** Execute all queued calls in a single protected call. An error in a
+   * callback is passed to the error function (see dub_call) and does not
+   * stop the following calls. Returns false if the flush itself failed.
+   */
+  bool dub_flush();
+
+  /** Post a message from any OS thread. This never blocks and does not
+   * touch the lua_State (lock-free stack). The message is owned by the
+   * Thread and deleted after delivery.
+   */
+  void dub_post(Message *msg);
+
+  /** Deliver posted messages with dub_pushcallback and dub_call. Must be
+   * called from the thread owning the lua_State. Messages from the same
+   * OS thread are delivered in posting order. Returns the number of
+   * messages taken from the queue.
+   */
+  int dub_drain();
+
   /** Lua thread that contains <self> on stack position 1. This lua thread
    * is public to ease object state manipulation from C++ (but stack *must
    * not* be messed up).
@@ -170,8 +378,370 @@ protected:
   /** Type name (allows faster check for cast).
    */
   const char *dub_typename_;
+
+  /** Number of values in the queue of calls.
+   */
+  int dub_queued_;
+
+  /** Messages posted from other threads (last posted first).
+   */
+  Message *volatile dub_posted_;
+};
+
+// ======================================================================
+// =============================================== dub::Pool
+// ======================================================================
+
+/** Statistics of a dub::Pool.
+ */
+struct PoolStats {
+  // Number of allocated objects.
+  size_t live;
+  // Maximum number of objects allocated at the same time.
+  size_t high_water;
+  // Memory reserved by the pool (returned to the system by trim).
+  size_t bytes;
+};
+
+/** Free-list allocator for objects of a fixed size. Bindings for classes
+ * with '@dub allocator: pool' use one pool per class and lua_State (see
+ * dub::ClassPool): constructors build objects with 'new(pool) T(...)' and
+ * the __gc method gives the memory back to the pool. Such objects must not
+ * be deleted with 'delete' from C++.
+ *
+ * Memory is reserved in chunks of growing size (up to 64 KB unless a
+ * single object is larger). Empty chunks are given back to the system with
+ * trim. The pool is not thread safe.
+ */
+class Pool {
+public:
+  explicit Pool(size_t size);
+
+  /** Return memory for one object. Throws std::bad_alloc if the memory
+   * cannot be reserved.
+   */
+  void *alloc();
+
+  /** Give back memory returned by alloc.
+   */
+  void free(void *ptr);
+
+  /** Number of bytes reserved by the next call to alloc (0 if a free block
+   * is available).
+   */
+  size_t nextChunkSize() const;
+
+  /** Count a block that was not returned by alloc but will be given back
+   * with free (block of the pool 'from' or a malloc block if 'from' is
+   * NULL). Used by dub::Allocator to shrink blocks in place.
+   */
+  void adopt(Pool *from);
+
+  /** Return the empty chunks to the system. Returns the number of bytes
+   * released.
+   */
+  size_t trim();
+
+  const PoolStats &stats() const {
+    return stats_;
+  }
+
+  /** Return all the memory to the system. Objects still allocated in the
+   * pool are lost.
+   */
+  void release();
+
+private:
+  // Allocator frees the adopted malloc blocks.
+  friend class Allocator;
+  struct Chunk;
+  // Size of a block (object size rounded to the alignment).
+  size_t size_;
+  // Number of blocks in the next chunk.
+  size_t count_;
+  void *free_;
+  // Last reserved chunk first.
+  Chunk *chunks_;
+  PoolStats stats_;
+};
+
+/** Push a table with the pool statistics ('live', 'high_water' and
+ * 'bytes').
+ */
+void pushstats(lua_State *L, const PoolStats &stats);
+
+/** Pools of a bound class. Each lua_State has its own dub::Pool (stored in
+ * the registry) so that states running in different threads never share a
+ * pool. The userdata of objects allocated in the pool are marked with the
+ * 'pooled' flag.
+ */
+class ClassPool {
+public:
+  explicit ClassPool(size_t size)
+    : size_(size) {}
+
+  /** Return the pool of the lua_State (created on first use). The memory is
+   * returned to the system when the lua_State is closed.
+   */
+  Pool &get(lua_State *L);
+
+private:
+  size_t size_;
 };
 
+// ======================================================================
+// =============================================== dub::Allocator
+// ======================================================================
+
+// Number of size classes in dub::Allocator.
+#define DUB_ALLOC_CLASSES 10
+// Allocations above this size use malloc.
+#define DUB_ALLOC_MAX_SMALL 256
+
+/** Memory statistics of a dub::Allocator.
+ */
+struct AllocStats {
+  // Memory used by Lua.
+  size_t bytes;
+  // Maximum memory used by Lua.
+  size_t peak;
+  // Memory reserved from the system (pool chunks and large blocks).
+  size_t reserved;
+  // Maximum reserved memory (0 = no limit).
+  size_t limit;
+  // Number of allocations above DUB_ALLOC_MAX_SMALL.
+  size_t large;
+};
+
+/** Memory allocator for a lua_State. Small blocks (userdata, small tables,
+ * strings) are served by one dub::Pool per size class and larger blocks by
+ * malloc. Empty chunks are returned to the system by trim (also called
+ * before failing an allocation above the limit) and all the memory is
+ * returned when the allocator is destroyed, so it must outlive the state:
+ *
+ *   dub::Allocator alloc;
+ *   lua_State *L = alloc.newstate();
+ *   ...
+ *   lua_close(L);
+ *
+ * An allocator must only be used by one state.
+ */
+class Allocator {
+public:
+  explicit Allocator(size_t limit = 0);
+
+  ~Allocator();
+
+  /** Create a new lua_State using this allocator.
+   */
+  lua_State *newstate();
+
+  /** The lua_Alloc function ('ud' is the allocator).
+   */
+  static void *alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+  /** Return the allocator used by a state or NULL if the state does not use
+   * a dub::Allocator.
+   */
+  static Allocator *get(lua_State *L);
+
+  /** Set a hard memory limit (0 = no limit) on the memory reserved from the
+   * system. Allocations above the limit fail with a Lua memory error.
+   * Shrinking a block never fails.
+   */
+  void setLimit(size_t limit) {
+    stats_.limit = limit;
+  }
+
+  const AllocStats &stats() const {
+    return stats_;
+  }
+
+  /** Return the empty chunks of all the size classes to the system. Call
+   * after a full garbage collection to lower the memory held after a peak.
+   * Returns the number of bytes released.
+   */
+  size_t trim();
+
+  /** Size of the blocks in size class 'i'.
+   */
+  static size_t classSize(int i);
+
+  /** Statistics of size class 'i'.
+   */
+  const PoolStats &classStats(int i) const {
+    return pools_[i]->stats();
+  }
+
+private:
+  // Return a block for 'size' bytes in size class 'cls' (-1 for malloc)
+  // or NULL. The memory limit is ignored if 'nolimit' is true.
+  void *newblock(int cls, size_t size, bool nolimit);
+
+  // Return true if 'size' more bytes can be reserved (trims if needed).
+  bool reserve(size_t size);
+
+  // Free the malloc blocks adopted by the pools (they are in the free lists
+  // once the state is closed).
+  void releaseAdopted();
+
+  Pool *pools_[DUB_ALLOC_CLASSES];
+  AllocStats stats_;
+  // Number of malloc blocks adopted by the pools.
+  size_t adopted_;
+};
+
+/** Push a table with the allocator statistics ('bytes', 'peak', 'reserved',
+ * 'limit', 'large' and 'classes', a list of pool statistics with the block
+ * 'size').
+ */
+void pushstats(lua_State *L, const Allocator &alloc);
+
+/** Lua function returning the memory statistics of the current state (nil
+ * if the state does not use a dub::Allocator).
+ */
+int memstats(lua_State *L);
+
+// ======================================================================
+// =============================================== dub::gcaccount
+// ======================================================================
+
+/** Statistics of the native memory reported to the Lua collector.
+ */
+struct GcStats {
+  // Native memory held by live objects.
+  size_t bytes;
+  // Maximum value of 'bytes'.
+  size_t peak;
+  // Number of objects with reported memory.
+  size_t objects;
+  // Number of collector steps run because of native memory.
+  size_t steps;
+  // Growth not yet passed to the collector (less than 1 KB).
+  size_t debt;
+};
+
+/** Set the native memory held by the object in 'udata' to 'size' bytes.
+ * The Lua collector only sees the userdata: growth is passed as a GC step
+ * (lua_gc LUA_GCSTEP with the size in KB) so that objects holding large
+ * buffers are collected as often as their real cost requires. Shrinking
+ * only updates the statistics and is safe from __gc. The bindings of
+ * classes with '@dub gc_size' call this after construction and with 0 on
+ * __gc, even if the object was deleted from C++ (dub::Object).
+ */
+void gcaccount(lua_State *L, DubUserdata *udata, size_t size);
+
+/** Same as above for the object at index 'idx' (userdata or table with a
+ * 'super' userdata). Custom bindings use this after a method changes the
+ * native memory held by 'self' (index 1).
+ */
+void gcaccount(lua_State *L, int idx, size_t size);
+
+/** Push a table with the native memory statistics ('bytes', 'peak',
+ * 'objects' and 'steps').
+ */
+void pushstats(lua_State *L, const GcStats &stats);
+
+/** Lua function returning the native memory statistics of the current
+ * state.
+ */
+int gcstats(lua_State *L);
+
+// ======================================================================
+// =============================================== dub::ClassStats
+// ======================================================================
+
+/** Lifetime statistics of the objects of a class. Bindings for classes with
+ * '@dub stats: true' declare one static instance. Constructors, copies
+ * returned by value and '@dub gc' methods count the objects they create and
+ * __gc removes them (also when the object was deleted from C++). Counters
+ * are updated atomically and can be read from any thread.
+ */
+class ClassStats {
+public:
+  /** 'name' is the metatable name and 'size' the size of an object.
+   */
+  ClassStats(const char *name, size_t size);
+
+  /** Count the new object at index 'idx' (userdata or table with a 'super'
+   * userdata) owned by Lua.
+   */
+  void add(lua_State *L, int idx);
+
+  /** Called by __gc with the userdata being finalized.
+   */
+  void remove(DubUserdata *udata);
+
+  const char *name() const {
+    return name_;
+  }
+
+  /** Objects counted by the bindings and not yet finalized.
+   */
+  size_t live() const {
+    return live_;
+  }
+
+  /** Total number of objects counted by the bindings.
+   */
+  size_t created() const {
+    return created_;
+  }
+
+  /** Number of finalized userdata owning their object.
+   */
+  size_t owned() const {
+    return owned_;
+  }
+
+  /** Number of finalized userdata not owning their object (pointers owned
+   * by C++).
+   */
+  size_t borrowed() const {
+    return borrowed_;
+  }
+
+  /** Memory used by the live objects (without memory they allocate).
+   */
+  size_t bytes() const {
+    return live_ * size_;
+  }
+
+  /** First statistics in the list of all classes (NULL if empty).
+   */
+  static const ClassStats *first();
+
+  /** Next statistics in the list of all classes.
+   */
+  const ClassStats *next() const {
+    return next_;
+  }
+
+  /** Find the statistics of a class by metatable name (NULL if the class
+   * does not record statistics).
+   */
+  static const ClassStats *find(const char *name);
+
+private:
+  const char *name_;
+  size_t size_;
+  volatile size_t live_;
+  volatile size_t created_;
+  volatile size_t owned_;
+  volatile size_t borrowed_;
+  ClassStats *next_;
+};
+
+/** Push a table with the statistics of a class ('live', 'created', 'owned',
+ * 'borrowed' and 'bytes').
+ */
+void pushstats(lua_State *L, const ClassStats &stats);
+
+/** Lua function returning a table with the statistics of all classes
+ * recording statistics (by metatable name).
+ */
+int stats(lua_State *L);
+
 // ======================================================================
 // =============================================== dub::pushclass
 // ======================================================================
@@ -228,9 +798,33 @@ struct DubRef {
  */
 void pushudata(lua_State *L, const void *ptr, const char *type_name, bool gc = true);
 
+/** Same as pushudata with a type name but uses the metatable resolved when
+ * opening the library. Can only be used from a bound function.
+ */
+void pushudata(lua_State *L, const void *ptr, const Type &type, bool gc = true);
+
+/** Same as pushudata but a pointer already known to Lua is pushed as the
+ * same userdata (identity cache, see dub::identity). The cache does not
+ * keep the userdata alive. Entries are only reused if the userdata still
+ * points to 'ptr' (dub::Object destructors clear the pointer). Can only be
+ * used from a bound function.
+ */
+void pushcached(lua_State *L, const void *ptr, const Type &type, bool gc = true);
+
+/** Return the type stored in the metatable at index 'mt' by dub::setup or
+ * NULL for opaque types and if 'mt' is not a table (module not loaded yet).
+ */
+const Type *mttype(lua_State *L, int mt);
+
+/** Push the metatable for the given type (resolved when opening the
+ * library). Can only be used from a bound function.
+ */
+inline void pushmetatable(lua_State *L, const Type &type) {
+  lua_rawgeti(L, lua_upvalueindex(1), type.slot);
+}
+
 template<class T>
-struct DubFullUserdata {
-  T *ptr;
+struct DubFullUserdata : public DubUserdata {
   T obj;
 };
 
@@ -238,16 +832,54 @@ template<class T>
 void pushfulldata(lua_State *L, const T &obj, const char *type_name) {
   DubFullUserdata<T> *copy = (DubFullUserdata<T>*)lua_newuserdata(L, sizeof(DubFullUserdata<T>));
   copy->obj = obj;
-  // now **copy gives back the object.
-  copy->ptr = &copy->obj;
 
   // the userdata is now on top of the stack
 
   // set metatable (contains methods)
   luaL_getmetatable(L, type_name);
+  // now **copy gives back the object.
+  initudata(copy, &copy->obj, mttype(L, -1), false);
+  lua_setmetatable(L, -2);
+}
+
+template<class T>
+void pushfulldata(lua_State *L, const T &obj, const Type &type) {
+  DubFullUserdata<T> *copy = (DubFullUserdata<T>*)lua_newuserdata(L, sizeof(DubFullUserdata<T>));
+  copy->obj = obj;
+  // now **copy gives back the object.
+  initudata(copy, &copy->obj, &type, false);
+
+  // set metatable (contains methods)
+  pushmetatable(L, type);
   lua_setmetatable(L, -2);
 }
 
+/** Push a userdata with storage for an object of type T (inline storage).
+ * The object must then be constructed in place with
+ * 'new(udata->ptr) T(...)' and the gc flag set once construction succeeded
+ * (the userdata is not finalized if the constructor throws). Can only be
+ * used from a bound function.
+ */
+template<class T>
+DubUserdata *newudata(lua_State *L, const Type &type) {
+  DubFullUserdata<T> *udata = (DubFullUserdata<T>*)lua_newuserdata(L, sizeof(DubFullUserdata<T>));
+  initudata(udata, &udata->obj, &type, false);
+
+  // set metatable (contains methods)
+  pushmetatable(L, type);
+  lua_setmetatable(L, -2);
+  return udata;
+}
+
+/** Return true if the object is stored inside the userdata (created with
+ * dub::newudata). The destructor must then be called in place instead of
+ * delete.
+ */
+template<class T>
+inline bool isinline(DubUserdata *udata) {
+  return udata->ptr == &static_cast<DubFullUserdata<T>*>(udata)->obj;
+}
+
 template<class T>
 void pushclass(lua_State *L, const T &obj, const char *type_name) {
   T *copy = new T(obj);
@@ -277,6 +909,579 @@ void pushclass2(lua_State *L, T *ptr, const char *type_name) {
   // <udata>
 }
 
+// ======================================================================
+// =============================================== sequences
+// ======================================================================
+
+/** Length of the table at index 'idx' (raw access).
+ */
+size_t rawlen(lua_State *L, int idx);
+
+// Push one element of a sequence (std::vector, C array).
+inline void pushelem(lua_State *L, double v) {
+  lua_pushnumber(L, v);
+}
+
+inline void pushelem(lua_State *L, float v) {
+  lua_pushnumber(L, v);
+}
+
+inline void pushelem(lua_State *L, int v) {
+  lua_pushinteger(L, v);
+}
+
+inline void pushelem(lua_State *L, const std::string &v) {
+  lua_pushlstring(L, v.data(), v.length());
+}
+
+// Read one element of a sequence. Return false if the value at 'idx' has the
+// wrong type.
+inline bool toelem(lua_State *L, int idx, double &v) {
+  if (lua_type(L, idx) != LUA_TNUMBER) return false;
+  v = lua_tonumber(L, idx);
+  return true;
+}
+
+inline bool toelem(lua_State *L, int idx, float &v) {
+  if (lua_type(L, idx) != LUA_TNUMBER) return false;
+  v = (float)lua_tonumber(L, idx);
+  return true;
+}
+
+inline bool toelem(lua_State *L, int idx, int &v) {
+  if (lua_type(L, idx) != LUA_TNUMBER) return false;
+  v = (int)lua_tointeger(L, idx);
+  return true;
+}
+
+inline bool toelem(lua_State *L, int idx, std::string &v) {
+  if (lua_type(L, idx) != LUA_TSTRING) return false;
+  size_t sz;
+  const char *s = lua_tolstring(L, idx, &sz);
+  v.assign(s, sz);
+  return true;
+}
+
+// Lua type name of elements (used in error messages).
+inline const char *elemtype(const double&)      { return "number"; }
+inline const char *elemtype(const float&)       { return "number"; }
+inline const char *elemtype(const int&)         { return "number"; }
+inline const char *elemtype(const std::string&) { return "string"; }
+
+/** Push 'n' elements from 'ptr' as a new Lua table (presized).
+ */
+template<class T>
+void pusharray(lua_State *L, const T *ptr, size_t n) {
+  lua_createtable(L, (int)n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    pushelem(L, ptr[i]);
+    lua_rawseti(L, -2, (int)i + 1);
+  }
+}
+
+/** Bulk read of a C array attribute: push elements [first, last] (1-based,
+ * arguments 'narg' and 'narg + 1', whole array by default) in the table at
+ * 'narg + 2' or in a new presized table. Returns 0 if the range is out of
+ * bounds.
+ */
+template<class T>
+int readarray(lua_State *L, const T *arr, size_t dim, int narg) {
+  lua_Integer first = luaL_optinteger(L, narg, 1);
+  lua_Integer last  = luaL_optinteger(L, narg + 1, (lua_Integer)dim);
+  if (first < 1 || last > (lua_Integer)dim || first > last + 1) return 0;
+  int n = (int)(last - first + 1);
+  if (lua_istable(L, narg + 2)) {
+    lua_pushvalue(L, narg + 2);
+  } else {
+    lua_createtable(L, n, 0);
+  }
+  for (int i = 0; i < n; ++i) {
+    pushelem(L, arr[first - 1 + i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+/** Bulk write of a C array attribute from the table at 'narg', starting at
+ * index 'narg + 1' (1 by default). Nothing is written if the elements do not
+ * fit in the array.
+ */
+template<class T>
+int writearray(lua_State *L, T *arr, size_t dim, int narg) {
+  luaL_checktype(L, narg, LUA_TTABLE);
+  lua_Integer first = luaL_optinteger(L, narg + 1, 1);
+  size_t n = rawlen(L, narg);
+  if (first < 1 || (size_t)first - 1 + n > dim) return 0;
+  T *dst = arr + (first - 1);
+  for (size_t i = 0; i < n; ++i) {
+    lua_rawgeti(L, narg, (int)i + 1);
+    if (!toelem(L, -1, dst[i])) {
+      return luaL_error(L, "bad element %d in argument #%d (expected %s, found %s)",
+          (int)i + 1, narg, elemtype(dst[i]), luaL_typename(L, -1));
+    }
+    lua_pop(L, 1);
+  }
+  return 0;
+}
+
+/** Set all elements of a C array attribute to the value at 'narg' (zero by
+ * default).
+ */
+template<class T>
+int fillarray(lua_State *L, T *arr, size_t dim, int narg) {
+  T value = T();
+  if (!lua_isnoneornil(L, narg) && !toelem(L, narg, value)) {
+    return luaL_error(L, "bad argument #%d (expected %s, found %s)",
+        narg, elemtype(value), luaL_typename(L, narg));
+  }
+  for (size_t i = 0; i < dim; ++i) {
+    arr[i] = value;
+  }
+  return 0;
+}
+
+/** Push a sequence container (std::vector) as a new Lua table (presized).
+ */
+template<class V>
+void pushseq(lua_State *L, const V &v) {
+  size_t n = v.size();
+  lua_createtable(L, (int)n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    pushelem(L, v[i]);
+    lua_rawseti(L, -2, (int)i + 1);
+  }
+}
+
+/** Fill a sequence container (std::vector) with the elements of the table at
+ * index 'narg'. The capacity is reserved before reading the table.
+ */
+template<class V>
+void checkseq(lua_State *L, int narg, V &v) DUB_THROW(dub::Exception) {
+  if (lua_type(L, narg) != LUA_TTABLE) {
+    throw TypeException(L, narg, "table");
+  }
+  size_t n = rawlen(L, narg);
+  typename V::value_type elem;
+  v.reserve(v.size() + n);
+  for (size_t i = 1; i <= n; ++i) {
+    lua_rawgeti(L, narg, (int)i);
+    if (!toelem(L, -1, elem)) {
+      Exception e("bad element %d in argument #%d (expected %s, found %s)",
+          (int)i, narg, elemtype(elem), luaL_typename(L, -1));
+      lua_pop(L, 1);
+      throw e;
+    }
+    lua_pop(L, 1);
+    v.push_back(elem);
+  }
+}
+
+/** Same as checkseq but calls lua_error instead of throwing (used by
+ * bindings without try/catch blocks).
+ */
+template<class V>
+void checkseq_n(lua_State *L, int narg, V &v) {
+  luaL_checktype(L, narg, LUA_TTABLE);
+  size_t n = rawlen(L, narg);
+  typename V::value_type elem;
+  v.reserve(v.size() + n);
+  for (size_t i = 1; i <= n; ++i) {
+    lua_rawgeti(L, narg, (int)i);
+    if (!toelem(L, -1, elem)) {
+      luaL_error(L, "bad element %d in argument #%d (expected %s, found %s)",
+          (int)i, narg, elemtype(elem), luaL_typename(L, -1));
+    }
+    lua_pop(L, 1);
+    v.push_back(elem);
+  }
+}
+
+/** Push a table with the keys and values of a map container (std::map,
+ * std::unordered_map).
+ */
+template<class M>
+void pushmap(lua_State *L, const M &m) {
+  lua_createtable(L, 0, (int)m.size());
+  for (typename M::const_iterator it = m.begin(); it != m.end(); ++it) {
+    pushelem(L, it->first);
+    pushelem(L, it->second);
+    lua_rawset(L, -3);
+  }
+}
+
+/** Fill a map container with the keys and values of the table at index
+ * 'narg'.
+ */
+template<class M>
+void checkmap(lua_State *L, int narg, M &m) DUB_THROW(dub::Exception) {
+  if (lua_type(L, narg) != LUA_TTABLE) {
+    throw TypeException(L, narg, "table");
+  }
+  typename M::key_type key;
+  typename M::mapped_type value;
+  lua_pushnil(L);
+  while (lua_next(L, narg)) {
+    // ... <key> <value>
+    if (!toelem(L, -2, key) || !toelem(L, -1, value)) {
+      Exception e("bad entry in argument #%d (expected %s keys and %s values)",
+          narg, elemtype(key), elemtype(value));
+      lua_pop(L, 2);
+      throw e;
+    }
+    m[key] = value;
+    lua_pop(L, 1);
+  }
+}
+
+/** Same as checkmap but calls lua_error instead of throwing.
+ */
+template<class M>
+void checkmap_n(lua_State *L, int narg, M &m) {
+  luaL_checktype(L, narg, LUA_TTABLE);
+  typename M::key_type key;
+  typename M::mapped_type value;
+  lua_pushnil(L);
+  while (lua_next(L, narg)) {
+    if (!toelem(L, -2, key) || !toelem(L, -1, value)) {
+      luaL_error(L, "bad entry in argument #%d (expected %s keys and %s values)",
+          narg, elemtype(key), elemtype(value));
+    }
+    m[key] = value;
+    lua_pop(L, 1);
+  }
+}
+
+// ======================================================================
+// =============================================== container views
+// ======================================================================
+
+/** Push a proxy userdata holding 'ptr' with the metatable of 'type' (built
+ * from Type::methods when opening the library). Can only be used from a
+ * bound function.
+ */
+void pushview(lua_State *L, const void *ptr, const Type &type);
+
+/** __newindex for read-only views.
+ */
+int readonlyview(lua_State *L);
+
+/** Proxy to a sequence container (std::vector). Elements are read and
+ * written in the live container with 1-based indices.
+ */
+template<class V>
+struct SeqView {
+  static V *self(lua_State *L) {
+    return *(V**)lua_touserdata(L, 1);
+  }
+
+  static int index(lua_State *L) {
+    V *v = self(L);
+    lua_Integer i = lua_tointeger(L, 2);
+    if (i < 1 || (size_t)i > v->size()) return 0;
+    pushelem(L, (*v)[i - 1]);
+    return 1;
+  }
+
+  static int newindex(lua_State *L) {
+    V *v = self(L);
+    lua_Integer i = lua_tointeger(L, 2);
+    typename V::value_type elem;
+    if (!toelem(L, 3, elem)) {
+      return luaL_error(L, "expected %s, found %s", elemtype(elem), luaL_typename(L, 3));
+    }
+    if (i >= 1 && (size_t)i <= v->size()) {
+      (*v)[i - 1] = elem;
+    } else if ((size_t)i == v->size() + 1) {
+      v->push_back(elem);
+    } else {
+      return luaL_error(L, "index %d out of range", (int)i);
+    }
+    return 0;
+  }
+
+  static int len(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)self(L)->size());
+    return 1;
+  }
+
+  static int next(lua_State *L) {
+    V *v = self(L);
+    lua_Integer i = lua_tointeger(L, 2) + 1;
+    if ((size_t)i > v->size()) return 0;
+    lua_pushinteger(L, i);
+    pushelem(L, (*v)[i - 1]);
+    return 2;
+  }
+
+  static int pairs(lua_State *L) {
+    lua_pushcfunction(L, next);
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, 0);
+    return 3;
+  }
+
+  // Metamethods of the proxy (rw) and of the read-only proxy (ro).
+  static const luaL_Reg rw[];
+  static const luaL_Reg ro[];
+};
+
+template<class V>
+const luaL_Reg SeqView<V>::rw[] = {
+  { "__index"   , index    },
+  { "__newindex", newindex },
+  { "__len"     , len      },
+  { "__pairs"   , pairs    },
+  { "__ipairs"  , pairs    },
+  { "__call"    , pairs    },
+  { NULL, NULL},
+};
+
+template<class V>
+const luaL_Reg SeqView<V>::ro[] = {
+  { "__index"   , index        },
+  { "__newindex", readonlyview },
+  { "__len"     , len          },
+  { "__pairs"   , pairs        },
+  { "__ipairs"  , pairs        },
+  { "__call"    , pairs        },
+  { NULL, NULL},
+};
+
+/** Proxy to a map container (std::map, std::unordered_map). Assigning nil
+ * removes the key.
+ */
+template<class M>
+struct MapView {
+  static M *self(lua_State *L) {
+    return *(M**)lua_touserdata(L, 1);
+  }
+
+  static int index(lua_State *L) {
+    M *m = self(L);
+    typename M::key_type key;
+    if (!toelem(L, 2, key)) return 0;
+    typename M::const_iterator it = m->find(key);
+    if (it == m->end()) return 0;
+    pushelem(L, it->second);
+    return 1;
+  }
+
+  static int newindex(lua_State *L) {
+    M *m = self(L);
+    typename M::key_type key;
+    if (!toelem(L, 2, key)) {
+      return luaL_error(L, "expected %s key, found %s", elemtype(key), luaL_typename(L, 2));
+    }
+    if (lua_isnil(L, 3)) {
+      m->erase(key);
+      return 0;
+    }
+    typename M::mapped_type value;
+    if (!toelem(L, 3, value)) {
+      return luaL_error(L, "expected %s, found %s", elemtype(value), luaL_typename(L, 3));
+    }
+    (*m)[key] = value;
+    return 0;
+  }
+
+  static int len(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)self(L)->size());
+    return 1;
+  }
+
+  static int next(lua_State *L) {
+    M *m = self(L);
+    typename M::const_iterator it;
+    if (lua_isnil(L, 2)) {
+      it = m->begin();
+    } else {
+      typename M::key_type key;
+      if (!toelem(L, 2, key)) return 0;
+      it = m->find(key);
+      if (it == m->end()) {
+        return luaL_error(L, "invalid key to 'next'");
+      }
+      ++it;
+    }
+    if (it == m->end()) return 0;
+    pushelem(L, it->first);
+    pushelem(L, it->second);
+    return 2;
+  }
+
+  static int pairs(lua_State *L) {
+    lua_pushcfunction(L, next);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+  }
+
+  // Metamethods of the proxy (rw) and of the read-only proxy (ro).
+  static const luaL_Reg rw[];
+  static const luaL_Reg ro[];
+};
+
+template<class M>
+const luaL_Reg MapView<M>::rw[] = {
+  { "__index"   , index    },
+  { "__newindex", newindex },
+  { "__len"     , len      },
+  { "__pairs"   , pairs    },
+  { "__call"    , pairs    },
+  { NULL, NULL},
+};
+
+template<class M>
+const luaL_Reg MapView<M>::ro[] = {
+  { "__index"   , index        },
+  { "__newindex", readonlyview },
+  { "__len"     , len          },
+  { "__pairs"   , pairs        },
+  { "__call"    , pairs        },
+  { NULL, NULL},
+};
+
+// ======================================================================
+// =============================================== ranges
+// ======================================================================
+
+/** Cursor of a begin()/end() iteration. The cursor is built in a userdata
+ * held as upvalue by the iterator function (see dub::pushrange).
+ */
+struct Range {
+  virtual ~Range() {}
+  virtual int next(lua_State *L) = 0;
+};
+
+template<class It>
+struct RangeOf : public Range {
+  It cur;
+  It last;
+  lua_Integer i;
+
+  RangeOf(It begin, It end)
+    : cur(begin)
+    , last(end)
+    , i(0)
+  {}
+
+  virtual int next(lua_State *L) {
+    if (cur == last) return 0;
+    lua_pushinteger(L, ++i);
+    pushelem(L, *cur);
+    ++cur;
+    return 2;
+  }
+};
+
+/** Iterator function for ranges: push the next index and element. The
+ * cursor is upvalue 1 (see pushrange).
+ */
+int rangenext(lua_State *L);
+
+/** Set the metatable of the range userdata at the top of the stack.
+ */
+void setrange(lua_State *L);
+
+/** Push the iterator function, a cursor on [begin, end) and nil for a
+ * generic for. Elements are pushed with dub::pushelem (no allocation).
+ */
+template<class It>
+int pushrange(lua_State *L, It begin, It end) {
+  void *cursor = lua_newuserdata(L, sizeof(RangeOf<It>));
+  new(cursor) RangeOf<It>(begin, end);
+  setrange(L);
+  // <cursor>
+  lua_pushvalue(L, -1);
+  lua_pushcclosure(L, rangenext, 1);
+  // <cursor> <next>
+  lua_insert(L, -2);
+  lua_pushnil(L);
+  return 3;
+}
+
+// ======================================================================
+// =============================================== dub::Buffer
+// ======================================================================
+
+/** Zero-copy view on contiguous native memory (array attributes, vectors,
+ * raw payloads). The buffer does not own the memory: bindings keep the owner
+ * alive with dub::protect. In Lua:
+ *
+ *   b[i], b[i] = v, #b         : element access (1-based).
+ *   b:getbytes([first, last])  : copy elements to a Lua string.
+ *   b:setbytes(s [, first])    : copy the bytes of a Lua string in the buffer.
+ *   b:ptr()                    : address as light userdata (LuaJIT ffi.cast).
+ *   b:ctype(), b:stride()      : element C type and stride in bytes.
+ */
+struct Buffer {
+  enum ElemType {
+    Int8, UInt8, Int16, UInt16, Int32, UInt32, Float, Double,
+  };
+
+  void *data;
+  // Number of elements.
+  size_t len;
+  // Distance between elements in bytes.
+  size_t stride;
+  ElemType type;
+  bool readonly;
+
+  /** C name of the element type.
+   */
+  static const char *ctype(ElemType type);
+
+  /** Size of an element in bytes.
+   */
+  static size_t elemsize(ElemType type);
+};
+
+inline Buffer::ElemType buftype(const char*)           { return Buffer::Int8;   }
+inline Buffer::ElemType buftype(const signed char*)    { return Buffer::Int8;   }
+inline Buffer::ElemType buftype(const unsigned char*)  { return Buffer::UInt8;  }
+inline Buffer::ElemType buftype(const short*)          { return Buffer::Int16;  }
+inline Buffer::ElemType buftype(const unsigned short*) { return Buffer::UInt16; }
+inline Buffer::ElemType buftype(const int*)            { return Buffer::Int32;  }
+inline Buffer::ElemType buftype(const unsigned int*)   { return Buffer::UInt32; }
+inline Buffer::ElemType buftype(const float*)          { return Buffer::Float;  }
+inline Buffer::ElemType buftype(const double*)         { return Buffer::Double; }
+
+/** Push a dub::Buffer on 'len' elements of type 'type' at 'data' with a
+ * distance of 'stride' bytes between elements.
+ */
+void pushbuffer(lua_State *L, const void *data, size_t len, Buffer::ElemType type, size_t stride, bool readonly);
+
+/** Push a dub::Buffer on the C array 'data'.
+ */
+template<class T>
+void pushbuffer(lua_State *L, T *data, size_t len) {
+  pushbuffer(L, data, len, buftype(data), sizeof(T), false);
+}
+
+/** Push a read-only dub::Buffer on the C array 'data'.
+ */
+template<class T>
+void pushbuffer(lua_State *L, const T *data, size_t len) {
+  pushbuffer(L, data, len, buftype(data), sizeof(T), true);
+}
+
+/** Push a dub::Buffer on the elements of 'v'. The buffer is invalid if the
+ * vector is resized.
+ */
+template<class T>
+void pushbuffer(lua_State *L, std::vector<T> &v) {
+  pushbuffer(L, v.empty() ? (T*)NULL : &v[0], v.size());
+}
+
+template<class T>
+void pushbuffer(lua_State *L, const std::vector<T> &v) {
+  pushbuffer(L, v.empty() ? (const T*)NULL : &v[0], v.size());
+}
+
+/** Check for a dub::Buffer at index 'narg'.
+ */
+Buffer *checkbuffer(lua_State *L, int narg);
+
 // ======================================================================
 // =============================================== constants
 // ======================================================================
@@ -295,16 +1500,16 @@ void register_const(lua_State *L, const const_Reg *l);
 
 // These provide the same funcionality as their equivalent luaL_check... but they
 // throw std::exception which can be caught (eventually to call lua_error).
-lua_Number checknumber(lua_State *L, int narg) throw(dub::TypeException);
-lua_Integer checkinteger(lua_State *L, int narg) throw(dub::TypeException);
-const char *checklstring(lua_State *L, int narg, size_t *len) throw(dub::TypeException);
-void **checkudata(lua_State *L, int ud, const char *tname, bool keep_mt = false) throw(dub::Exception);
+lua_Number checknumber(lua_State *L, int narg) DUB_THROW(dub::TypeException);
+lua_Integer checkinteger(lua_State *L, int narg) DUB_THROW(dub::TypeException);
+const char *checklstring(lua_State *L, int narg, size_t *len) DUB_THROW(dub::TypeException);
+void **checkudata(lua_State *L, int ud, const char *tname, bool keep_mt = false) DUB_THROW(dub::Exception);
 
 // Super aware userdata calls (finds userdata inside provided table with table.super).
-void **checksdata(lua_State *L, int ud, const char *tname, bool keep_mt = false) throw(dub::Exception);
+void **checksdata(lua_State *L, int ud, const char *tname, bool keep_mt = false) DUB_THROW(dub::Exception);
 // Super aware userdata calls that DOES NOT check for dangling pointers (used in 
 // __gc binding).
-void **checksdata_d(lua_State *L, int ud, const char *tname) throw(dub::Exception);
+void **checksdata_d(lua_State *L, int ud, const char *tname) DUB_THROW(dub::Exception);
 // Return pointer if the type is correct. Used to resolve overloaded functions when there
 // is no other alternative (arg count, native types). We return the pointer so that we can
 // optimize away the corresponding 'dub_checksdata'.
@@ -314,11 +1519,115 @@ void **issdata(lua_State *L, int ud, const char *tname, int type);
 // implementations for luaL_error (luajit throws an exception on luaL_error).
 void **checksdata_n(lua_State *L, int ud, const char *tname, bool keep_mt = false);
 
-inline const char *checkstring(lua_State *L, int narg) throw(dub::TypeException) {
+// Same as above but using the types resolved when opening the library. These can
+// only be used from a bound function. They return the object pointer, cast to the
+// requested type with the cast table of the userdata type (no allocation).
+void *checkudata(lua_State *L, int ud, const Type &type, bool keep_mt = false) DUB_THROW(dub::Exception);
+void *checksdata(lua_State *L, int ud, const Type &type, bool keep_mt = false) DUB_THROW(dub::Exception);
+void *issdata(lua_State *L, int ud, const Type &type, int type_id);
+void *checksdata_n(lua_State *L, int ud, const Type &type, bool keep_mt = false);
+// Returns the userdata header (used in __gc binding).
+DubUserdata *checksdata_d(lua_State *L, int ud, const Type &type) DUB_THROW(dub::Exception);
+// Variants of issdata and checksdata_d that do not throw exceptions (use lua_error).
+// These are used by bindings generated without try/catch blocks.
+void *issdata_n(lua_State *L, int ud, const Type &type, int type_id);
+DubUserdata *checksdata_dn(lua_State *L, int ud, const Type &type);
+
+// ======================================================================
+// =============================================== dub::pushshared
+// ======================================================================
+
+/** Header of userdata holding a std::shared_ptr (the 'shared' flag is set).
+ * The reference is released by the function stored in the header so that
+ * __gc does not depend on C++11.
+ */
+struct SharedUserdata : public DubUserdata {
+  void (*release)(SharedUserdata *udata);
+};
+
+/** Drop the std::shared_ptr reference held by the userdata (called by __gc
+ * instead of deleting the object).
+ */
+inline void releaseshared(DubUserdata *udata) {
+  SharedUserdata *shared = static_cast<SharedUserdata*>(udata);
+  udata->shared = false;
+  udata->gc     = false;
+  shared->release(shared);
+}
+
+/** Return the header of the object at index 'narg' (userdata or table with a
+ * 'super' userdata) if it is held by a std::shared_ptr or NULL.
+ */
+SharedUserdata *toshared(lua_State *L, int narg);
+
+#ifdef DUB_SHARED_PTR
+/** Userdata with the owning std::shared_ptr stored inline (no holder
+ * allocation). The pointer type is erased: parameters get a
+ * std::shared_ptr<T> through the aliasing constructor.
+ */
+struct SharedPtrUserdata : public SharedUserdata {
+  std::shared_ptr<void> owner;
+};
+
+inline void releaseshared_ptr(SharedUserdata *udata) {
+  typedef std::shared_ptr<void> Owner;
+  static_cast<SharedPtrUserdata*>(udata)->owner.~Owner();
+}
+
+/** Push a userdata sharing the ownership of 'obj' (nil if 'obj' is empty).
+ * __gc drops the reference.
+ */
+template<class T>
+void pushshared(lua_State *L, const std::shared_ptr<T> &obj, const Type &type) {
+  if (!obj) {
+    lua_pushnil(L);
+    return;
+  }
+  SharedPtrUserdata *udata = (SharedPtrUserdata*)lua_newuserdata(L, sizeof(SharedPtrUserdata));
+  initudata(udata, const_cast<void*>(static_cast<const void*>(obj.get())), &type, true);
+  new(&udata->owner) std::shared_ptr<void>(obj, udata->ptr);
+  udata->release = releaseshared_ptr;
+  udata->shared  = true;
+
+  // set metatable (contains methods)
+  pushmetatable(L, type);
+  lua_setmetatable(L, -2);
+}
+
+/** Return a std::shared_ptr<T> sharing the ownership of the object at index
+ * 'narg'. The pointer is cast to T with the cast tables (upcast) and the
+ * aliasing constructor keeps the original control block. Objects not held by
+ * a std::shared_ptr raise an error.
+ */
+template<class T>
+std::shared_ptr<T> checkshared(lua_State *L, int narg, const Type &type) {
+  T *ptr = (T *)checksdata(L, narg, type);
+  SharedUserdata *udata = toshared(L, narg);
+  if (!udata) {
+    throw Exception("expected %s held by std::shared_ptr", type.name);
+  }
+  return std::shared_ptr<T>(static_cast<SharedPtrUserdata*>(udata)->owner, ptr);
+}
+
+/** Same as checkshared but calls lua_error instead of throwing (used by
+ * bindings generated without try/catch blocks).
+ */
+template<class T>
+std::shared_ptr<T> checkshared_n(lua_State *L, int narg, const Type &type) {
+  T *ptr = (T *)checksdata_n(L, narg, type);
+  SharedUserdata *udata = toshared(L, narg);
+  if (!udata) {
+    luaL_error(L, "expected %s held by std::shared_ptr", type.name);
+  }
+  return std::shared_ptr<T>(static_cast<SharedPtrUserdata*>(udata)->owner, ptr);
+}
+#endif // DUB_SHARED_PTR
+
+inline const char *checkstring(lua_State *L, int narg) DUB_THROW(dub::TypeException) {
   return checklstring(L, narg, NULL);
 }
 
-inline int checkboolean(lua_State *L, int narg) throw() {
+inline int checkboolean(lua_State *L, int narg) DUB_NOTHROW {
   return lua_toboolean(L, narg);
 }
 
@@ -326,6 +1635,31 @@ inline int checkboolean(lua_State *L, int narg) throw() {
 // and number.
 int error(lua_State *L);
 
+/** Error object pushed by bindings generated with the 'lazy_errors' option.
+ * It carries the binding name, location and structured exception fields and
+ * only builds the message when converted with tostring.
+ */
+struct Error {
+  // Bound function name.
+  const char *func;
+  // Same as dub::Exception fields. When format is NULL, the message is
+  // stored in 'message'.
+  const char *format;
+  const char *type;
+  const char *found;
+  int narg;
+  // Line of the caller (0 if unknown) and source in 'where'.
+  int line;
+  char where[LUA_IDSIZE];
+  char message[1];
+};
+
+// Push a dub::Error for the exception caught in binding 'func'. Nothing is
+// formatted: the message is built by __tostring. Raise with dub::error.
+void pusherror(lua_State *L, const char *func, const std::exception &e);
+// Same as above for unknown exceptions (catch (...)).
+void pusherror(lua_State *L, const char *func);
+
 // This is a Lua binding called whenever we ask for obj:deleted() in Lua
 int isDeleted(lua_State *L);
 
@@ -338,6 +1672,30 @@ void protect(lua_State *L, int owner, int original, const char *key);
  */
 void setup(lua_State *L, const char *class_name);
 
+/** Same as setup with a class name but also stores the type in '_type_' so
+ * that userdata pushed by name (dub::Object::dub_pushobject) get a typed
+ * header.
+ */
+void setup(lua_State *L, const Type &type);
+
+/** Wrap the C __index function of the metatable on top of the stack in a Lua
+ * function that finds methods in the metatable and only calls the C function
+ * for other keys (attributes). Method calls are then plain table lookups that
+ * do not enter C (and can be compiled by LuaJIT).
+ */
+void luaindex(lua_State *L);
+
+/** Create the identity cache (weak values table indexed by object pointer)
+ * in the metatable on top of the stack. Objects of this class pushed with
+ * dub::pushcached or dub::Object::dub_pushobject are then always the same
+ * userdata for the same pointer.
+ */
+void identity(lua_State *L);
+
+// Class id for a metatable name (32 bit sdbm hash). Must match
+// dub.LuaBinder.typeId.
+unsigned int classid(const char *name);
+
 // sdbm function: taken from http://www.cse.yorku.ca/~oz/hash.html
 // This version is slightly adapted to cope with different
 // hash sizes (and to be easy to write in Lua).
@@ -349,8 +1707,60 @@ void printStack(lua_State *L, const char *msg = NULL);
 // Compatibility with luaL_register on lua 5.1 and 5.2
 void fregister(lua_State *L, const luaL_Reg *l);
 
+// Resolve the metatables for the NULL terminated list of types and register
+// the functions with the resolved list as first upvalue. The optional NULL
+// terminated list of attribute keys is interned in the lua_State and indexed
+// in a KeyIndex passed as second upvalue (see dub::keyindex).
+void fregister(lua_State *L, const luaL_Reg *l, const Type *types, const char *const *keys = NULL);
+
+// Strings longer then this are not interned in Lua 5.2.1 and later.
+#define DUB_MAXSHORTLEN 40
+
+/** Attribute keys interned in a lua_State. Maps the address of the interned
+ * Lua string to the key position (open addressing, 'mask + 1' slots).
+ */
+struct KeyIndex {
+  struct Slot {
+    const char *key;
+    int index;
+  };
+  size_t mask;
+  Slot slots[1];
+};
+
+// Lookup by content for keys that are not interned.
+int keyindex_s(lua_State *L, int idx);
+
+/** Return the position (starting at 1) of the key at index 'idx' in the
+ * attribute keys passed to dub::fregister or 0 if the key is not an
+ * attribute. Lua strings are interned: the key is found by address with no
+ * string hashing or comparison. Can only be used from a bound function.
+ */
+inline int keyindex(lua_State *L, int idx) {
+  const char *key = lua_tostring(L, idx);
+  if (!key) return 0;
+  const KeyIndex *ki = (const KeyIndex*)lua_touserdata(L, lua_upvalueindex(2));
+  size_t i = ((size_t)key >> 3) & ki->mask;
+  for (; ki->slots[i].key; i = (i + 1) & ki->mask) {
+    if (ki->slots[i].key == key) return ki->slots[i].index;
+  }
+  return keyindex_s(L, idx);
+}
+
 
 } // dub
+
+/** Build an object in a dub::Pool with 'new(pool) T(...)'.
+ */
+inline void *operator new(size_t, dub::Pool &pool) {
+  return pool.alloc();
+}
+
+/** Called if the constructor of an object built in a pool throws.
+ */
+inline void operator delete(void *ptr, dub::Pool &pool) {
+  pool.free(ptr);
+}
   
 #endif // DUB_BINDING_GENERATOR_DUB_H_
 
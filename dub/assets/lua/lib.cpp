@@ -15,6 +15,9 @@
 using namespace {{namespace.name}};
 {% end %}
 
+// --=============================================== TYPES
+/* dub types */
+
 extern "C" {
 {% for _, class in ipairs(classes) do %}
 int luaopen_{{self:openName(class)}}(lua_State *{{self.L}});
@@ -26,17 +29,25 @@ int luaopen_{{self:openName(class)}}(lua_State *{{self.L}});
  * {{method.location}}
  */
 static int {{string.gsub(method:fullcname(), '::', '_')}}(lua_State *{{self.L}}) {
-{% if method:neverThrows() then %}
+{% if self:neverThrows(method) then %}
 
   {| self:functionBody(method) |}
 {% else %}
   try {
     {| self:functionBody(method) |}
+{% if self.options.lazy_errors then %}
+  } catch (std::exception &e) {
+    dub::pusherror({{self.L}}, "{{self:libName(method)}}", e);
+  } catch (...) {
+    dub::pusherror({{self.L}}, "{{self:libName(method)}}");
+  }
+{% else %}
   } catch (std::exception &e) {
     lua_pushfstring({{self.L}}, "{{self:libName(method)}}: %s", e.what());
   } catch (...) {
     lua_pushfstring({{self.L}}, "{{self:libName(method)}}: Unknown exception");
   }
+{% end %}
   return lua_error({{self.L}});
 {% end %}
 }
@@ -73,7 +84,7 @@ DUB_EXPORT int luaopen_{{self.options.luaopen or lib_name}}(lua_State *{{self.L}
   // register global constants
   dub::register_const({{self.L}}, {{lib_name}}_const);
 {% end %}
-  dub::fregister({{self.L}}, {{lib_name}}_functions);
+  dub::fregister({{self.L}}, {{lib_name}}_functions, dub_types);
   // <lib>
 
   {{ self:openClasses(classes) }}
@@ -29,8 +29,9 @@
   Lua to avoid binding and function calls overhead.
 
   For example, it would be a bad idea to loop through all the pixels of an image
-  using operator[](int i) to implement a filter in Lua. In such a case, use [LuaJIT FFI](http://luajit.org/ext_ffi.html)
-  to build a buffer, copy content inside the buffer and work from there.
+  using operator[](int i) to implement a filter in Lua. In such a case, return
+  a [buffer](#Buffers) on the pixels and use [LuaJIT FFI](http://luajit.org/ext_ffi.html)
+  to work directly on the native memory (no copy).
   
   ## Use Case
 
@@ -305,6 +306,187 @@ lib.BUILD = {
     collectgarbage 'collect'
     --> b is destroyed
 
+  ## Reference count
+
+  Classes with an intrusive reference count name the methods adding and
+  removing a reference with `@dub retain` and `@dub release`:
+
+    /** @dub retain: AddRef
+     *       release: Release
+     */
+    class Node {
+      ...
+    };
+
+  Each userdata then holds a reference instead of using garbage collection
+  protection: pointers to existing objects are retained when pushed, `__gc`
+  calls the release method (the destructor can be private) and pointer
+  attributes retain the new value and release the previous one. Objects
+  returned by constructors or `@dub gc` methods are expected to come with a
+  reference. The retain and release methods are not bound.
+
+  ## Inline storage
+
+  With the `storage = 'inline'` option of dub.LuaBinder (or `@dub storage:
+  inline` in the class documentation), objects created by constructors and
+  returned by value are built with placement new inside the userdata instead
+  of a separate heap allocation. The destructor is called in place on `__gc`.
+  Classes with a custom `push`, `destructor` or `destroy` setting keep heap
+  storage.
+
+  ## Shared pointers
+
+  `std::shared_ptr<T>` parameters and return values are supported for bound
+  classes (needs C++11). The returned `std::shared_ptr` is stored inside the
+  userdata (no holder allocation) and `__gc` drops the reference instead of
+  deleting the object. Parameters receive a `std::shared_ptr<T>` sharing the
+  ownership of the userdata: casts to super classes use the aliasing
+  constructor. Passing an object not held by a `std::shared_ptr` raises an
+  error, while `T *` parameters accept both kinds of objects.
+
+  With the `storage = 'shared'` option of dub.LuaBinder (or `@dub storage:
+  shared` in the class documentation), objects created by constructors and
+  returned by value are built with `std::make_shared` so that they can be
+  passed to C++ code keeping references.
+
+  ## Pool allocator
+
+  With the `allocator = 'pool'` option of dub.LuaBinder (or `@dub allocator:
+  pool` in the class documentation), objects created by constructors are
+  allocated in a free-list pool (dub::Pool) and given back to the pool on
+  `__gc`. Each lua_State has its own pool for the class so states running in
+  different threads do not share memory. Pooled objects must not be deleted
+  with `delete` from C++: classes with a custom `push` (`dub::Object`
+  subclasses), `destructor` or `destroy` setting do not use the pool. Pool
+  statistics (for the current lua_State) are returned by `_pool_`:
+
+    local stats = lib.Foo._pool_()
+    print(stats.live, stats.high_water, stats.bytes)
+
+  ## Lua allocator
+
+  The dub runtime provides an optional `lua_Alloc` (dub::Allocator) serving
+  small blocks (userdata, small tables and strings) from size-class pools and
+  larger blocks with malloc. Pool chunks grow up to 64 KB and are kept for
+  reuse: `trim()` returns the empty chunks to the system (for example after a
+  full collection) and all the memory is returned when the allocator is
+  destroyed (after `lua_close`). The allocator keeps per state statistics
+  and can enforce a hard limit on the memory reserved from the system (the
+  allocator trims before failing and shrinking a block never fails):
+
+    dub::Allocator alloc(16 * 1024 * 1024);
+    lua_State *L = alloc.newstate();
+    lua_register(L, "memstats", dub::memstats);
+
+  From Lua, `memstats()` returns `bytes` (used by Lua), `peak`, `reserved`
+  (pool chunks and malloc blocks), `limit`, `large` (count of malloc blocks)
+  and `classes` (pool statistics for each block size).
+
+  ## Native memory
+
+  The Lua collector only sees the userdata header, not the memory held by the
+  C++ object. Use `@dub gc_size` in the class documentation to report this
+  memory: the value is a method returning the size in bytes, a number of
+  bytes or a quoted expression using `self`:
+
+    /** @dub gc_size: bytes
+     */
+    class Image {
+      ...
+      size_t bytes() const;
+    };
+
+  Constructors report the size with `dub::gcaccount` which runs a collector
+  step proportional to the new memory (`lua_gc` with `LUA_GCSTEP`) and `__gc`
+  releases it, also for `dub::Object` instances deleted from C++. Custom
+  bindings call `dub::gcaccount(L, 1, size)` when a method changes the
+  memory held by self. `dub::gcstats` is a Lua function returning `bytes`,
+  `peak`, `objects` and `steps`:
+
+    lua_register(L, "gcstats", dub::gcstats);
+
+  ## Object statistics
+
+  With the `stats = true` option of dub.LuaBinder (or `@dub stats: true` in
+  the class documentation), the class bindings declare a dub::ClassStats
+  updated atomically by constructors, copies returned by value, `@dub gc`
+  methods and `__gc`. The statistics are returned by `_stats_`:
+
+    local stats = lib.Foo._stats_()
+    print(stats.live, stats.created, stats.owned, stats.borrowed, stats.bytes)
+
+  `owned` and `borrowed` count the finalized userdata owning their object or
+  not. `dub::stats` is a Lua function returning the statistics of all the
+  classes by metatable name and `dub::ClassStats::find` gives them from C++:
+
+    lua_register(L, "stats", dub::stats);
+
+  ## Container views
+
+  Attributes and returned references of type `std::vector`, `std::map` or
+  `std::unordered_map` (with number or string elements) are pushed as proxy
+  userdata instead of being copied in a table. The proxy reads and writes the
+  live container and keeps its owner alive:
+
+    local s = mesh.samples
+    print(#s, s[1])
+    s[#s + 1] = 4.5
+    for i, v in s() do print(i, v) end
+
+  Const references give read-only proxies. The proxy metatables are created
+  when the library is opened and belong to the binding file (they are not
+  shared by name with other libraries). With Lua 5.2 and later, `pairs`
+  can be used instead of calling the proxy. Values returned by copy and
+  parameters are converted from and to Lua tables.
+
+  ## Buffers
+
+  A `dub.Buffer` is a zero-copy view on native memory. Methods returning a
+  pointer with `@dub buffer: size` (number of elements given by the `size`
+  method) or a `std::vector` reference with `@dub buffer: true` push a buffer.
+  C array attributes of numbers have a `name_buffer()` method. The buffer
+  keeps its owner alive:
+
+    local px = image:pixels()
+    print(#px, px[1], px:ctype(), px:stride())
+    px[1] = 255
+    local bytes = px:getbytes()   -- copy to a Lua string
+    px:setbytes(bytes, 2)         -- copy from a Lua string
+    -- LuaJIT
+    local p = ffi.cast(px:ctype() .. ' *', px:ptr())
+
+  Const pointers and references give read-only buffers. The buffer must not be
+  used after the memory is reallocated (vector resized).
+
+  ## Iteration
+
+  Classes with `size()` and an integer `operator[]` or with `begin()` and
+  `end()` iterators on numbers or strings get an `iter()` method (also used as
+  `__pairs` with Lua 5.2 and later):
+
+    for i, v in series:iter() do print(i, v) end
+
+  Indices go from 1 to `size()` in both cases (`operator[]` is called with
+  `i - 1`). Indexed iteration does not allocate (the iterator state is the
+  object itself) and ranges keep the cursor in a single userdata for the
+  whole loop. `begin()` and `end()` are not bound when they are used by
+  `iter()`. Disable with `@dub iter: false`.
+
+  ## Identity cache
+
+  By default, each method returning a pointer or reference pushes a new
+  userdata. With the `identity` option of dub.LuaBinder (or `@dub identity: true`
+  in the class documentation), a pointer already known to Lua is returned as
+  the same userdata:
+
+    local s = box:size()
+    print(rawequal(s, box:size()))
+    --> true
+
+  The cache uses weak values and does not keep objects alive. Classes deriving
+  from `dub::Object` must use `@dub push: dub_pushobject` so that the C++
+  destructor invalidates the cached userdata.
+
   # Operator overloading
   
   All `operator[xx]()` functions in C++ are translated to native Lua operators
@@ -370,6 +552,48 @@ lib.BUILD = {
     -- manual call to resized callback
     win:resized(win:width(), win:height())
 
+  For callbacks called very often, the key can be resolved once with
+  `dub_callbackref` and the returned handle used instead of the name. Only the
+  key is cached: reassigning `win.resized` from Lua is seen by the next call.
+
+    #C++
+        if (!resized_ref_) resized_ref_ = dub_callbackref("resized");
+        if (!dub_pushcallback(resized_ref_)) return;
+
+  Objects receiving many events can queue the calls and deliver them in a
+  single protected call with `dub_flush`. An error in a callback is passed to
+  the `error` function and does not stop the following calls.
+
+    #C++
+        // Arguments are pushed on dub_L (without <func> <self>).
+        lua_pushnumber(dub_L, x);
+        lua_pushnumber(dub_L, y);
+        dub_queuecallback(moved_ref_, 2);
+        // ... later, once per tick
+        dub_flush();
+
+  To notify a Lua object from another OS thread (I/O, decoding), post a
+  `dub::Message` with `dub_post`. This never blocks and does not touch the
+  lua_State. The thread owning the lua_State delivers the messages with
+  `dub_drain` (same error handling as `dub_call`).
+
+    #C++
+    class Progress : public dub::Message {
+    public:
+      Progress(int ref, double value) : dub::Message(ref), value_(value) {}
+      virtual int push(lua_State *L) const {
+        lua_pushnumber(L, value_);
+        return 1;
+      }
+    private:
+      double value_;
+    };
+
+        // Worker thread (progress_ref_ is resolved in the Lua thread).
+        dub_post(new Progress(progress_ref_, 0.5));
+        // ... Lua thread, once per tick
+        dub_drain();
+
 
   ## Errors in callbacks
 
@@ -503,14 +727,27 @@ lib.BUILD = {
   * pseudo-attributes read/write by calling getter/setter methods.
   * custom read/write attributes (with void *userdata helper, union handling)
   * public static attributes read/write
+  * C array attributes of numbers read/written in bulk with `obj:d_slice(first,
+    last [, t])`, `obj:d_setslice(t [, first])`, `obj:d_fill([value])` and
+    `obj:d_copy(other)` (one call instead of one per element)
   * pointer to member (gc protected)
   * cast(default)/copy/disable const attribute
   * natural casting from std::string to string type (can include '\0')
+  * std::string_view parameters point to the Lua string (no copy)
+  * (const char *data, size_t len) parameters passed as a single Lua string
+    with `@dub lstring: data` (no copy)
+  * std::vector of numbers or strings converted from and to Lua tables
+    (presized tables, reserved vectors, raw access)
+  * (const T *ptr, size_t n) parameters passed as a single Lua table with
+    `@dub array: ptr`
   * class instantiation from templates through typedefs
   * class alias through typedefs
   * bindings for superclass
   * default argument values
   * overloaded functions with optimized method selection from arguments
+  * allocation-free operator variants: `a:add_into(b, out)` (out = a + b) and
+    `a:add_assign(b)` (a = a + b) for +, -, * and / returning the class by
+    value (ignore with `@dub ignore: add_into, add_assign`)
   * return value optimization (no copy)
   * simple type garbage collection optimization (no __gc method)
   * namespace
@@ -532,6 +769,16 @@ lib.BUILD = {
   passes the exceptions as lua errors. Internally, the library itself throws
   `dub::Exception` and `dub::TypeException`.
 
+  Methods declared with `throw ()`, `noexcept` or `noexcept(true)` are bound
+  without try/catch blocks and use `luaL_check...` functions. Setting the
+  `exceptions` option of dub.LuaBinder to `false` generates all bindings this
+  way (smaller code): the bound C++ code must then never throw.
+
+  With the `lazy_errors` option, bindings raise a `dub.Error` userdata instead
+  of a string. The error keeps the fields of the exception (`func`, `type`,
+  `found`, `narg`) and the message is only formatted by `tostring(err)`. This
+  is faster for code that catches errors with `pcall` without printing them.
+
 --]]
 local DUB_MAX_IN_SHIFT = 4294967296
 
@@ -0,0 +1,56 @@
+#ifndef MEMORY_ARENA_H_
+#define MEMORY_ARENA_H_
+
+#include "dub/dub.h"
+
+/** This class is used to test dub::Allocator: it runs code in a separate
+ * lua_State using the allocator.
+ */
+class Arena {
+  dub::Allocator alloc_;
+  lua_State *state_;
+public:
+  Arena(int limit = 0)
+    : alloc_(limit)
+    , state_(alloc_.newstate())
+    {}
+
+  ~Arena() {
+    lua_close(state_);
+  }
+
+  /** Run Lua code in the state. Returns false on errors (garbage is then
+   * collected).
+   */
+  bool run(const char *code) {
+    if (luaL_loadstring(state_, code) || lua_pcall(state_, 0, 0, 0)) {
+      lua_pop(state_, 1);
+      lua_gc(state_, LUA_GCCOLLECT, 0);
+      return false;
+    }
+    return true;
+  }
+
+  /** Return the memory statistics of the state.
+   */
+  LuaStackSize stats(lua_State *L) {
+    dub::pushstats(L, alloc_);
+    return 1;
+  }
+
+  /** Collect garbage and return the empty chunks to the system. Returns
+   * the number of bytes released.
+   */
+  double trim() {
+    lua_gc(state_, LUA_GCCOLLECT, 0);
+    return alloc_.trim();
+  }
+
+  /** Memory used as seen by the state.
+   */
+  double used() {
+    return lua_gc(state_, LUA_GCCOUNT, 0) * 1024 + lua_gc(state_, LUA_GCCOUNTB, 0);
+  }
+};
+
+#endif // MEMORY_ARENA_H_
@@ -0,0 +1,34 @@
+#ifndef MEMORY_COUNTED_H_
+#define MEMORY_COUNTED_H_
+
+#include "dub/dub.h"
+
+/** This class is used to test object statistics (dub::ClassStats).
+ *
+ * @dub stats: true
+ */
+struct Counted {
+  double x;
+
+  Counted(double x_)
+    : x(x_)
+    {}
+
+  Counted operator+(const Counted &v) {
+    return Counted(x + v.x);
+  }
+
+  /** Pointer owned by C++ (borrowed userdata).
+   */
+  Counted *self() {
+    return this;
+  }
+
+  /** Statistics of all classes.
+   */
+  static LuaStackSize stats(lua_State *L) {
+    return dub::stats(L);
+  }
+};
+
+#endif // MEMORY_COUNTED_H_
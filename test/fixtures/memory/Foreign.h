@@ -0,0 +1,28 @@
+#ifndef MEMORY_FOREIGN_H_
+#define MEMORY_FOREIGN_H_
+
+#include "dub/dub.h"
+
+#include <string.h> // memset
+
+/** This class is used to test that type checks do not trust userdata
+ * created by other libraries, even if their bytes look like a dub header.
+ */
+class Foreign {
+public:
+  Foreign() {}
+
+  /** Push a userdata with a dub magic number, an invalid type pointer and a
+   * metatable not setup by dub.
+   */
+  static LuaStackSize forge(lua_State *L) {
+    DubUserdata *udata = (DubUserdata*)lua_newuserdata(L, sizeof(DubUserdata));
+    memset(udata, 0xff, sizeof(DubUserdata));
+    udata->magic = DUB_UDATA_MAGIC;
+    lua_newtable(L);
+    lua_setmetatable(L, -2);
+    return 1;
+  }
+};
+
+#endif // MEMORY_FOREIGN_H_
@@ -0,0 +1,75 @@
+#ifndef MEMORY_IMAGE_H_
+#define MEMORY_IMAGE_H_
+
+#include "dub/dub.h"
+
+#include <stddef.h> // size_t
+
+/** This class is used to test native memory reported to the Lua collector:
+ * the pixels are not seen by Lua.
+ *
+ * @dub gc_size: bytes
+ */
+class Image {
+  size_t bytes_;
+  char *pixels_;
+public:
+  Image(int width, int height)
+    : bytes_(width * height * 4)
+    , pixels_(new char[bytes_])
+  {
+    ++count();
+  }
+
+  ~Image() {
+    delete[] pixels_;
+    --count();
+  }
+
+  size_t bytes() const {
+    return bytes_;
+  }
+
+  /** Number of images alive.
+   */
+  static int live() {
+    return count();
+  }
+
+  /** Native memory statistics of the state.
+   */
+  static LuaStackSize gcstats(lua_State *L) {
+    return dub::gcstats(L);
+  }
+
+private:
+  static int &count() {
+    static int count = 0;
+    return count;
+  }
+};
+
+/** Same as Image but deleted from C++ (dub::Object).
+ *
+ * @dub push: dub_pushobject
+ *      gc_size: 'self->width() * 1024'
+ */
+class Canvas : public dub::Object {
+  int width_;
+public:
+  Canvas(int width)
+    : width_(width) {}
+
+  int width() const {
+    return width_;
+  }
+
+  /** Delete from C++: the reported memory is released when the Lua userdata
+   * is collected.
+   */
+  static void kill(Canvas *canvas) {
+    delete canvas;
+  }
+};
+
+#endif // MEMORY_IMAGE_H_
@@ -0,0 +1,27 @@
+#ifndef MEMORY_POOLED_H_
+#define MEMORY_POOLED_H_
+
+/** This class is used to compare execution with objects allocated in a
+ * pool (Withgc version uses new/delete).
+ *
+ * @dub allocator: pool
+ */
+struct Pooled {
+  double x;
+  double y;
+
+  Pooled(double x_, double y_)
+    : x(x_)
+    , y(y_)
+    {}
+
+  double surface() {
+    return x * y;
+  }
+
+  Pooled operator+(const Pooled &v) {
+    return Pooled(x + v.x, y + v.y);
+  }
+};
+
+#endif // MEMORY_POOLED_H_
@@ -0,0 +1,85 @@
+#ifndef MEMORY_REF_COUNTED_H_
+#define MEMORY_REF_COUNTED_H_
+
+#include <stddef.h> // NULL
+
+/** This class is used to test intrusive reference counts: userdata and the
+ * 'next' attribute hold a reference. New nodes start with one reference.
+ *
+ * @dub retain: retain
+ *      release: release
+ */
+class Node {
+  int refs_;
+  int value_;
+public:
+  Node *next;
+
+  Node(int value)
+    : refs_(1)
+    , value_(value)
+    , next(NULL)
+  {
+    ++count();
+  }
+
+  void retain() {
+    ++refs_;
+  }
+
+  void release() {
+    if (--refs_ == 0) {
+      delete this;
+    }
+  }
+
+  int refs() const {
+    return refs_;
+  }
+
+  int value() const {
+    return value_;
+  }
+
+  /** Pointer owned by C++ (retained by the userdata).
+   */
+  Node *self() {
+    return this;
+  }
+
+  /** Number of nodes alive.
+   */
+  static int live() {
+    return count();
+  }
+
+private:
+  ~Node() {
+    if (next) next->release();
+    --count();
+  }
+
+  static int &count() {
+    static int count = 0;
+    return count;
+  }
+};
+
+/** This class is used to test that '@dub release' without '@dub retain'
+ * does not bind the private destructor.
+ *
+ * @dub release: release
+ */
+class Handle {
+  Handle() {}
+  ~Handle() {}
+public:
+  static Handle *instance() {
+    static Handle handle;
+    return &handle;
+  }
+
+  void release() {}
+};
+
+#endif // MEMORY_REF_COUNTED_H_
@@ -0,0 +1,75 @@
+#ifndef MEMORY_SERIES_H_
+#define MEMORY_SERIES_H_
+
+#include <stddef.h> // NULL
+#include <vector>
+
+/** This class is used to test iteration with size() and operator[] (iter
+ * and __pairs without allocation).
+ */
+class Series {
+  std::vector<double> values_;
+public:
+  Series(int count)
+    : values_(count)
+  {
+    for (int i = 0; i < count; ++i) {
+      values_[i] = i * 2;
+    }
+  }
+
+  size_t size() const {
+    return values_.size();
+  }
+
+  double operator[](int i) const {
+    if (i < 0 || (size_t)i >= values_.size()) {
+      return 0;
+    }
+    return values_[i];
+  }
+};
+
+/** This class is used to test iteration with begin() and end() (cursor in
+ * a single userdata).
+ */
+class Samples {
+  std::vector<double> values_;
+public:
+  Samples(int count)
+    : values_(count)
+  {
+    for (int i = 0; i < count; ++i) {
+      values_[i] = i + 0.5;
+    }
+  }
+
+  std::vector<double>::const_iterator begin() const {
+    return values_.begin();
+  }
+
+  std::vector<double>::const_iterator end() const {
+    return values_.end();
+  }
+};
+
+/** This class is used to test that begin() and end() are bound when they
+ * do not return iterators on numbers or strings (no iter method).
+ */
+class Segment {
+  Segment *next_;
+public:
+  Segment()
+    : next_(NULL)
+  {}
+
+  Segment *begin() {
+    return this;
+  }
+
+  Segment *end() {
+    return next_;
+  }
+};
+
+#endif // MEMORY_SERIES_H_
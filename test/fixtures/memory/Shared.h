@@ -0,0 +1,80 @@
+#ifndef MEMORY_SHARED_H_
+#define MEMORY_SHARED_H_
+
+#include <memory>
+#include <vector>
+
+/** This class is used to test std::shared_ptr parameters (upcast with the
+ * aliasing constructor).
+ */
+class Asset {
+  int id_;
+public:
+  Asset(int id)
+    : id_(id)
+  {
+    ++count();
+  }
+
+  virtual ~Asset() {
+    --count();
+  }
+
+  int id() const {
+    return id_;
+  }
+
+  /** Number of assets alive.
+   */
+  static int live() {
+    return count();
+  }
+
+private:
+  static int &count() {
+    static int count = 0;
+    return count;
+  }
+};
+
+/** This class is used to test objects created by the bindings with
+ * std::make_shared.
+ *
+ * @dub storage: shared
+ */
+class Texture : public Asset {
+public:
+  Texture(int id)
+    : Asset(id) {}
+};
+
+/** This class is used to test std::shared_ptr references held in C++.
+ */
+class Cache {
+  std::vector<std::shared_ptr<Asset> > assets_;
+public:
+  Cache() {}
+
+  void add(std::shared_ptr<Asset> asset) {
+    assets_.push_back(asset);
+  }
+
+  /** Returns nil in Lua if 'i' is out of range.
+   */
+  std::shared_ptr<Asset> get(int i) {
+    if (i < 0 || (size_t)i >= assets_.size()) {
+      return std::shared_ptr<Asset>();
+    }
+    return assets_[i];
+  }
+
+  int useCount(int i) {
+    return (int)assets_[i].use_count();
+  }
+
+  void clear() {
+    assets_.clear();
+  }
+};
+
+#endif // MEMORY_SHARED_H_
@@ -10,6 +10,7 @@ class A;
  *   * nested classes
  *   * custom __tostring method
  *   * lua_State pseudo-parameter
+ *   * operator variants with a namespaced return type
  */
 class B {
 public:
@@ -58,6 +59,14 @@ public:
   C *getC() {
     return c;
   }
+
+  Nem::B operator+(const B &other) const {
+    return B(nb_ + other.nb_);
+  }
+
+  Nem::B operator+(int n) const {
+    return B(nb_ + n);
+  }
 };
 
 } // Nem
@@ -3,6 +3,8 @@
 
 #include "Vect.h"
 #include <string>
+#include <vector>
+#include <map>
 
 typedef struct Vect Vortex;
 
@@ -15,6 +17,11 @@ typedef struct Vect Vortex;
  *   * pointer member types and gc.
  *   * complex default values.
  *   * customized __tostring from dub settings.
+ *   * (const char *, size_t) parameters passed as one string.
+ *   * std::vector and (const T *, size_t) conversion to Lua tables.
+ *   * proxies to container members and references.
+ *   * zero-copy buffers on native memory.
+ *   * attribute names longer than Lua short strings (not interned).
  *
  *  @dub string_format: '%%s' %%fx%%f
  *       string_args: self->name_.c_str(), self->size_.x, self->size_.y
@@ -35,11 +42,22 @@ struct Box {
    */
   const Vect *const_vect;
 
+  /** Container member (proxy in Lua).
+   */
+  std::vector<double> samples;
+
+  std::map<std::string, double> props;
+
+  /** More than DUB_MAXSHORTLEN chars.
+   */
+  double long_attribute_name_that_lua_does_not_intern;
+
   Box(const std::string &name, const Vect &size = Vect(0,0))
     : name_(name)
     , size_(size)
     , position(NULL)
     , const_vect(NULL)
+    , long_attribute_name_that_lua_does_not_intern(0)
   {}
 
   /** Set gc to on. 
@@ -82,6 +100,64 @@ struct Box {
   Vect *copySize() {
     return new Vect(size_);
   }
+
+  /** Set name from a buffer without copying the Lua string.
+   * @dub lstring: data
+   */
+  void setName(const char *data, size_t len) {
+    name_.assign(data, len);
+  }
+
+  std::vector<double> scale(const std::vector<double> &values, double s) {
+    std::vector<double> res(values);
+    for (size_t i = 0; i < res.size(); ++i) {
+      res[i] *= s;
+    }
+    return res;
+  }
+
+  /** Sum of a C array.
+   * @dub array: values
+   */
+  double sum(const double *values, size_t count) {
+    double res = 0;
+    for (size_t i = 0; i < count; ++i) {
+      res += values[i];
+    }
+    return res;
+  }
+
+  std::vector<std::string> repeatName(int count) {
+    return std::vector<std::string>(count, name_);
+  }
+
+  /** Read-only proxy.
+   */
+  const std::vector<double> &constSamples() {
+    return samples;
+  }
+
+  std::map<std::string, double> &propsRef() {
+    return props;
+  }
+
+  /** Read-only buffer on the name bytes.
+   * @dub buffer: nameSize
+   */
+  const unsigned char *nameBytes() {
+    return (const unsigned char*)name_.data();
+  }
+
+  size_t nameSize() {
+    return name_.size();
+  }
+
+  /** Buffer on the samples memory.
+   * @dub buffer: true
+   */
+  std::vector<double> &samplesBuffer() {
+    return samples;
+  }
 };
 
 #endif // POINTERS_BOX_H_
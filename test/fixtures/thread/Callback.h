@@ -22,7 +22,8 @@ public:
   static int destroy_count;
 
   Callback(const std::string &name_)
-    : name(name_) {
+    : name(name_)
+    , callback_ref_(0) {
   }
 
   ~Callback() {
@@ -50,6 +51,22 @@ private:
    * Call implementation depends on scripting language (see [lang]_callback.cpp).
    */
   void call(const std::string &msg);
+
+  /** Same as call but using a callback handle instead of the name.
+   */
+  void callRef(const std::string &msg);
+
+  /** Queue 'count' calls and execute them in a single flush.
+   */
+  void callQueued(const std::string &msg, int count);
+
+  /** Post 'count' messages from each of 'thread_count' OS threads and
+   * deliver them until all are received. Returns the number of delivered
+   * messages.
+   */
+  int postMany(int thread_count, int count);
+
+  int callback_ref_;
 };
 
 #endif // THREAD_CALLBACK_H_
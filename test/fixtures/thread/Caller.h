@@ -22,6 +22,39 @@ public:
     }
   }
 
+  /** Simulate many calls from C++ (used to compare callback by name and
+   * with a handle).
+   */
+  void callMany(const std::string &msg, int count, bool use_ref) {
+    if (!clbk_) return;
+    if (use_ref) {
+      for (int i = 0; i < count; ++i) {
+        clbk_->callRef(msg);
+      }
+    } else {
+      for (int i = 0; i < count; ++i) {
+        clbk_->call(msg);
+      }
+    }
+  }
+
+  /** Simulate many calls from C++ delivered in a single batch.
+   */
+  void callQueued(const std::string &msg, int count) {
+    if (clbk_) {
+      clbk_->callQueued(msg, count);
+    }
+  }
+
+  /** Simulate calls posted from many OS threads (stress test).
+   */
+  int postMany(int thread_count, int count) {
+    if (clbk_) {
+      return clbk_->postMany(thread_count, count);
+    }
+    return 0;
+  }
+
   /** Simulate delete from C++
    */
   void destroyCallback() {
@@ -1,5 +1,8 @@
 #include "Callback.h"
 
+#include <pthread.h>
+#include <vector>
+
 void Callback::call(const std::string &msg) {
   if (!dub_pushcallback("callback")) return;
   // <func> <self>
@@ -7,6 +10,27 @@ void Callback::call(const std::string &msg) {
   // <func> <self> <msg>
   dub_call(2, 0);
 }
+
+void Callback::callRef(const std::string &msg) {
+  // Resolve key once.
+  if (!callback_ref_) callback_ref_ = dub_callbackref("callback");
+  if (!dub_pushcallback(callback_ref_)) return;
+  // <func> <self>
+  lua_pushlstring(dub_L, msg.data(), msg.length());
+  // <func> <self> <msg>
+  dub_call(2, 0);
+}
+
+void Callback::callQueued(const std::string &msg, int count) {
+  if (!callback_ref_) callback_ref_ = dub_callbackref("callback");
+  for (int i = 0; i < count; ++i) {
+    lua_pushlstring(dub_L, msg.data(), msg.length());
+    // <msg>
+    dub_queuecallback(callback_ref_, 1);
+  }
+  // Execute all calls.
+  dub_flush();
+}
   
 double Callback::getValue(const std::string &key) {
   lua_State *L = dub_L;
@@ -20,4 +44,63 @@ double Callback::getValue(const std::string &key) {
   return d;
 }
 
+/** Message posted from a producer thread: callback(producer_id, index).
+ */
+class PostedValue : public dub::Message {
+public:
+  PostedValue(int ref, int id, int index)
+    : dub::Message(ref)
+    , id_(id)
+    , index_(index) {}
+
+  virtual int push(lua_State *L) const {
+    lua_pushnumber(L, id_);
+    lua_pushnumber(L, index_);
+    return 2;
+  }
+
+private:
+  int id_;
+  int index_;
+};
+
+struct Producer {
+  Callback *clbk;
+  int ref;
+  int id;
+  int count;
+};
+
+static void *produce(void *data) {
+  Producer *p = (Producer *)data;
+  for (int i = 1; i <= p->count; ++i) {
+    p->clbk->dub_post(new PostedValue(p->ref, p->id, i));
+  }
+  return NULL;
+}
+
+int Callback::postMany(int thread_count, int count) {
+  // Resolve key in the thread owning the lua_State.
+  if (!callback_ref_) callback_ref_ = dub_callbackref("callback");
+  std::vector<pthread_t> threads(thread_count);
+  std::vector<Producer> producers(thread_count);
+  for (int i = 0; i < thread_count; ++i) {
+    Producer p = {this, callback_ref_, i + 1, count};
+    producers[i] = p;
+    pthread_create(&threads[i], NULL, produce, &producers[i]);
+  }
+
+  // Deliver while producers are running.
+  int total = thread_count * count;
+  int received = 0;
+  while (received < total) {
+    received += dub_drain();
+  }
+
+  for (int i = 0; i < thread_count; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  return received;
+}
+
 int Callback::destroy_count = 0;
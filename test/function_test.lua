@@ -114,6 +114,25 @@ function should.respondToNeverThrows()
   assertFalse(add:neverThrows())
 end
 
+function should.respondToNeverThrowsWithNoexcept()
+  local function make(throw)
+    return dub.Function {
+      name = 'hop',
+      definition = 'hop',
+      argsstring = '()',
+      db   = Simple.db,
+      parent = Simple,
+      params_list = {},
+      throw = throw,
+    }
+  end
+  assertTrue(make('noexcept'):neverThrows())
+  assertTrue(make('noexcept(true)'):neverThrows())
+  assertTrue(make('throw()'):neverThrows())
+  assertFalse(make('noexcept(false)'):neverThrows())
+  assertFalse(make('throw (std::bad_alloc)'):neverThrows())
+end
+
 function should.respondToSetName()
 end
 
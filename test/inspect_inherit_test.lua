@@ -52,7 +52,7 @@ function should.listUnknownParentsDeclaredInDubComment()
   dub.warn = dub.printWarn
 end
 
-function should.haveCastForUnknownParent()
+function should.notListCastsAsMethods()
   local Orphan = ins:find 'Orphan'
   local res = {}
   for elem in Orphan:methods() do
@@ -60,7 +60,6 @@ function should.haveCastForUnknownParent()
   end
   assertValueEqual({
     '~Orphan',
-    '_cast_',
     'Orphan',
   }, res)
 end
@@ -74,7 +73,6 @@ function should.listSuperMethods()
   assertValueEqual({
     '_set_',
     '_get_',
-    '_cast_',
     'Child',
     '~Child',
     'x',
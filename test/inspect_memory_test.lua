@@ -41,9 +41,20 @@ function should.notHaveADestructor()
     'Nogc:static',
     'surface',
     'operator+',
+    'add_into',
+    'add_assign',
   }, res)
 end       
               
+function should.recordBeginEndRange()
+  local Samples = ins:find('Samples')
+  -- Iterators are not bound as methods.
+  assertNil(Samples:method('begin'))
+  assertNil(Samples:method('end'))
+  assertEqual('begin', Samples.iter_range.begin.name)
+  assertEqual('end', Samples.iter_range['end'].name)
+end
+
 function should.notHavePrivateDestructor()
   local PrivateDtor = ins:find('PrivateDtor')
   local res = {}
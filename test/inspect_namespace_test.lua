@@ -165,6 +165,9 @@ function should.findMethodsInParent()
     'B',
     '__tostring',
     'getC',
+    'operator+',
+    'add_into',
+    'add_assign',
   }, res)
 end
 
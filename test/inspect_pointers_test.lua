@@ -117,6 +117,9 @@ function should.listBoxAttributes()
     'size_',
     'position',
     'const_vect',
+    'samples',
+    'props',
+    'long_attribute_name_that_lua_does_not_intern',
   }, res)
 end
 
@@ -166,19 +169,32 @@ function should.listMethods()
   assertValueEqual({
     Vect.SET_ATTR_NAME,
     'd',
+    'd_slice',
+    'd_setslice',
+    'd_fill',
+    'd_copy',
+    'd_buffer',
     'Vect:static',
     '~Vect',
 --  'd_set',
     'surface',
     'operator=',
     'operator+',
+    'add_into',
+    'add_assign',
     'operator+=',
     'operator-',
+    'sub_into',
+    'sub_assign',
     -- unary minus
     'operator- ',
     'operator-=',
     'operator*',
+    'mul_into',
+    'mul_assign',
     'operator/',
+    'div_into',
+    'div_assign',
     'operator<',
     'operator<=',
     'operator==',
@@ -212,10 +228,29 @@ function should.listStaticMethods()
     'sizeRef',
     'constRef',
     'copySize',
+    'setName',
+    'scale',
+    'sum',
+    'repeatName',
+    'constSamples',
+    'propsRef',
+    'nameBytes',
+    'nameSize',
+    'samplesBuffer',
     'MakeBox:static',
   }, res)
 end
 
+function should.mergeLstringParams()
+  local Box = ins:find('Box')
+  local met = Box:method('setName')
+  assertEqual(1, #met.params_list)
+  local p = met.params_list[1]
+  assertEqual('data', p.name)
+  assertEqual('len', p.lstring)
+  assertEqual(1, met.min_arg_size)
+end
+
 function should.staticMethodShouldBeStatic()
   local Box = ins:find('Box')
   local met = Box:method('MakeBox')
@@ -140,6 +140,8 @@ function should.listMethods()
     'Vectf',
     'surface',
     'operator+',
+    'add_into',
+    'add_assign',
     'addToX',
     'addTwo',
   }, res)
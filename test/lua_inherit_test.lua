@@ -25,6 +25,11 @@ local ins = dub.Inspector {
 
 local Child, Parent, Orphan
 
+-- Pattern matching the dub::Type used for 'mt_name' in the last generated code.
+local function typeRef(mt_name)
+  return (string.gsub(binder:typeRef(mt_name), '[%[%]]', '%%%0'))
+end
+
 function should.setup()
   dub.warn = dub.silentWarn
 end
@@ -57,9 +62,18 @@ end
 function should.bindCastWithTemplateParent()
   -- __newindex for simple (native) types
   local Orphan = ins:find('Orphan')
-  local met = Orphan:method(Orphan.CAST_NAME)
-  local res = binder:functionBody(Orphan, met)
-  assertMatch('%*retval__ = static_cast<Foo< int > %*>%(self%);', res)
+  local res = binder:bindClass(Orphan)
+  assertMatch('return static_cast<Foo< int > %*>%(%(Orphan %*%)ptr%);', res)
+end
+
+function should.declareSuperClassCasts()
+  local Child = ins:find('Child')
+  local res = binder:bindClass(Child)
+  local parent_id = string.format('0x%08x', binder:typeId('Parent'))
+  local child_id  = string.format('0x%08x', binder:typeId('Child'))
+  assertMatch('static void %*dub_cast_1%(void %*ptr%) {\n  return static_cast<Parent %*>%(%(Child %*%)ptr%);', res)
+  assertMatch('static const dub::Cast dub_casts%[%] = {\n  { '..parent_id..', dub_cast_1 },', res)
+  assertMatch('{ "Child" +, 1, '..child_id..', dub_casts },', res)
 end
 
 function should.notBindSuperStaticMethods()
@@ -74,8 +88,8 @@ function should.properlyBindUnknownTypes()
   local Child = ins:find('Child')
   local met = Child:method('methodWithUnknown')
   local res = binder:functionBody(Child, met)
-  assertMatch('Unk1 %*x = %*%(%(Unk1 %*%*%)dub::checksdata%(L, 2, "Unk1"%)%);', res)
-  assertMatch('Unk2 %*y = %*%(%(Unk2 %*%*%)dub::checksdata%(L, 3, "Unk2"%)%);', res)
+  assertMatch('Unk1 %*x = %(%(Unk1 %*%)dub::checksdata%(L, 2, '..typeRef('Unk1')..'%)%);', res)
+  assertMatch('Unk2 %*y = %(%(Unk2 %*%)dub::checksdata%(L, 3, '..typeRef('Unk2')..'%)%);', res)
   assertMatch('methodWithUnknown%(%*x, y%)', res)
 end
 
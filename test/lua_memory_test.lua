@@ -29,6 +29,11 @@ local ins = dub.Inspector(ins_opts)
 
 local mem
 
+-- Pattern matching the dub::Type used for 'mt_name' in the last generated code.
+local function typeRef(mt_name)
+  return (string.gsub(binder:typeRef(mt_name), '[%[%]]', '%%%0'))
+end
+
 --=============================================== Nogc bindings
 
 function should.bindClass()
@@ -47,7 +52,7 @@ function should.pushFullUserdataInRetval()
   local Nogc = ins:find('Nogc')
   local met = Nogc:method('operator+')
   local res = binder:functionBody(Nogc, met)
-  assertMatch('dub::pushfulldata<Nogc>%(L, self%->operator%+%(%*v%), "Nogc"%);', res)
+  assertMatch('dub::pushfulldata<Nogc>%(L, self%->operator%+%(%*v%), '..typeRef('Nogc')..'%);', res)
 end
 
 function should.useCustomPush()
@@ -63,6 +68,214 @@ function should.bindDestructor()
   assertMatch('__gc', res)
 end
 
+--=============================================== Pooled bindings
+
+function should.declarePoolWithAllocatorPool()
+  local Pooled = ins:find('Pooled')
+  local res = binder:bindClass(Pooled)
+  assertMatch('static dub::ClassPool dub_pool%(sizeof%(Pooled%)%);', res)
+  assertMatch('dub::pushstats%(L, dub_pool.get%(L%).stats%(%)%);', res)
+  assertMatch('"_pool_"', res)
+end
+
+function should.allocateInPoolInCtor()
+  local Pooled = ins:find('Pooled')
+  local met = Pooled:method('Pooled')
+  local res = binder:functionBody(Pooled, met)
+  assertMatch('retval__ = new%(dub_pool.get%(L%)%) Pooled%(x_, y_%);', res)
+  assertMatch('true%);\n%(%(DubUserdata%*%)lua_touserdata%(L, %-1%)%)%->pooled = true;\nreturn 1;', res)
+end
+
+function should.freeInPoolInDtor()
+  local Pooled = ins:find('Pooled')
+  local met = Pooled:method('~Pooled')
+  local res = binder:functionBody(Pooled, met)
+  assertMatch('if %(userdata%->pooled%) {\n    self%->~Pooled%(%);\n    dub_pool.get%(L%).free%(self%);\n  } else {\n    delete self;', res)
+end
+
+function should.notUsePoolWithoutAllocatorPool()
+  local Withgc = ins:find('Withgc')
+  local res = binder:bindClass(Withgc)
+  assertNotMatch('dub_pool', res)
+end
+
+function should.notUsePoolForObjectsDeletedInCpp()
+  local pool = dub.LuaBinder {allocator = 'pool'}
+  assertTrue(pool:poolAllocator(ins:find('Withgc')))
+  -- dub::Object
+  assertFalse(pool:poolAllocator(ins:find('Pen')))
+end
+
+--=============================================== Native memory
+
+function should.declareGcSizeFunction()
+  local Image = ins:find('Image')
+  assertEqual('self->bytes()', binder:gcSize(Image))
+  local res = binder:bindClass(Image)
+  assertMatch('static size_t dub_gcsize%(Image %*self%) {\n *return self%->bytes%(%);', res)
+end
+
+function should.useGcSizeExpression()
+  local Canvas = ins:find('Canvas')
+  assertEqual('self->width() * 1024', binder:gcSize(Canvas))
+  assertNil(binder:gcSize(ins:find('Pooled')))
+end
+
+function should.reportNativeMemoryInCtor()
+  local Image = ins:find('Image')
+  local res = binder:functionBody(Image, Image:method('Image'))
+  assertMatch('dub::gcaccount%(L, %-1, dub_gcsize%(retval__%)%);\nreturn 1;', res)
+  local Canvas = ins:find('Canvas')
+  res = binder:functionBody(Canvas, Canvas:method('Canvas'))
+  assertMatch('dub_pushobject%(L, retval__, "Canvas", true%);\ndub::gcaccount%(L, %-1, dub_gcsize%(retval__%)%);', res)
+end
+
+function should.releaseNativeMemoryInDtor()
+  local Image = ins:find('Image')
+  local res = binder:functionBody(Image, Image:method('~Image'))
+  assertMatch('dub::gcaccount%(L, userdata, 0%);\nif %(userdata%->shared%)', res)
+  local Pooled = ins:find('Pooled')
+  res = binder:functionBody(Pooled, Pooled:method('~Pooled'))
+  assertNotMatch('gcaccount', res)
+end
+
+--=============================================== std::shared_ptr
+
+function should.bindSharedPtrParameters()
+  local Cache = ins:find('Cache')
+  local res = binder:functionBody(Cache, Cache:method('add'))
+  assertMatch('std::shared_ptr<Asset> asset = dub::checkshared<Asset>%(L, 2, '..typeRef('Asset')..'%);', res)
+  assertMatch('self%->add%(asset%);', res)
+end
+
+function should.pushSharedPtrReturnValues()
+  local Cache = ins:find('Cache')
+  local res = binder:functionBody(Cache, Cache:method('get'))
+  assertMatch('dub::pushshared%(L, self%->get%(i%), '..typeRef('Asset')..'%);', res)
+end
+
+function should.makeSharedInCtorWithSharedStorage()
+  local Texture = ins:find('Texture')
+  assertTrue(binder:sharedStorage(Texture))
+  assertFalse(binder:sharedStorage(ins:find('Asset')))
+  local res = binder:functionBody(Texture, Texture:method('Texture'))
+  assertMatch('std::shared_ptr<Texture> retval__ = std::make_shared<Texture>%(id%);\ndub::pushshared%(L, retval__, '..typeRef('Texture')..'%);', res)
+end
+
+function should.releaseSharedPtrInDtor()
+  local Texture = ins:find('Texture')
+  local res = binder:functionBody(Texture, Texture:method('~Texture'))
+  assertMatch('if %(userdata%->shared%) {\n  dub::releaseshared%(userdata%);\n} else if %(userdata%->gc%) {', res)
+end
+
+--=============================================== Object statistics
+
+function should.declareClassStats()
+  local Counted = ins:find('Counted')
+  assertTrue(binder:classStats(Counted))
+  assertFalse(binder:classStats(ins:find('Withgc')))
+  local res = binder:bindClass(Counted)
+  assertMatch('static dub::ClassStats dub_stats%("Counted", sizeof%(Counted%)%);', res)
+  assertMatch('"_stats_" *, Counted__stats_', res)
+end
+
+function should.countObjectsOwnedByLua()
+  local Counted = ins:find('Counted')
+  local res = binder:functionBody(Counted, Counted:method('Counted'))
+  assertMatch('true%);\ndub_stats.add%(L, %-1%);\nreturn 1;', res)
+  -- copy
+  res = binder:functionBody(Counted, Counted:method('operator+'))
+  assertMatch('dub_stats.add%(L, %-1%);', res)
+  -- borrowed
+  res = binder:functionBody(Counted, Counted:method('self'))
+  assertNotMatch('dub_stats', res)
+  res = binder:functionBody(Counted, Counted:method('~Counted'))
+  assertMatch('dub_stats.remove%(userdata%);\nif %(userdata%->shared%)', res)
+end
+
+--=============================================== Reference count
+
+function should.retainBorrowedPointers()
+  local Node = ins:find('Node')
+  assertEqual('retain', (binder:refCount(Node)))
+  assertNil(binder:refCount(ins:find('Withgc')))
+  local res = binder:functionBody(Node, Node:method('self'))
+  assertMatch('retval__%->retain%(%);\ndub::pushudata%(L, retval__, '..typeRef('Node')..', true%);', res)
+  assertNotMatch('protect', res)
+  -- New objects come with a reference.
+  res = binder:functionBody(Node, Node:method('Node'))
+  assertNotMatch('retain', res)
+  -- Not bound
+  assertNil(Node:method('retain'))
+  assertNil(Node:method('release'))
+end
+
+function should.retainPointersInSetAttribute()
+  local Node = ins:find('Node')
+  local res = binder:functionBody(Node, Node:method(Node.SET_ATTR_NAME))
+  assertMatch('next__%->retain%(%);\nif %(self%->next%) self%->next%->release%(%);\nself%->next = next__;', res)
+  assertNotMatch('protect', res)
+end
+
+function should.releaseInDtor()
+  local Node = ins:find('Node')
+  -- Private destructor
+  local res = binder:functionBody(Node, Node:method('~Node'))
+  assertMatch('self%->release%(%);', res)
+  assertNotMatch('delete', res)
+end
+
+function should.notBindPrivateDtorWithReleaseOnly()
+  local Handle = ins:find('Handle')
+  assertNil(binder:refCount(Handle))
+  assertEqual('private', Handle.cache['~Handle'])
+  local res = binder:bindClass(Handle)
+  assertNotMatch('__gc', res)
+  assertNotMatch('delete self', res)
+end
+
+--=============================================== Iteration
+
+function should.iterateWithSizeAndIndex()
+  local Series = ins:find('Series')
+  assertEqual('index', binder:iterable(Series))
+  local res = binder:bindClass(Series)
+  assertMatch('"iter" *, Series__iter_', res)
+  assertMatch('"__pairs" *, Series__iter_', res)
+  res = binder:iterNextBody(Series)
+  assertMatch('lua_Integer i = lua_isnil%(L, 2%) %? 1 : lua_tointeger%(L, 2%) %+ 1;', res)
+  assertMatch('if %(i > %(lua_Integer%)self%->size%(%)%) return 0;', res)
+  assertMatch('lua_pushnumber%(L, self%->operator%[%]%(i %- 1%)%);\nreturn 2;', res)
+end
+
+function should.iterateWithBeginEnd()
+  local Samples = ins:find('Samples')
+  assertEqual('range', binder:iterable(Samples))
+  local res = binder:iterBody(Samples)
+  assertMatch('dub::pushrange%(L, self%->begin%(%), self%->end%(%)%);', res)
+  assertMatch('dub::protect%(L, lua_gettop%(L%) %- 1, 1, "_"%);', res)
+  -- Iterators are not bound.
+  res = binder:bindClass(Samples)
+  assertNotMatch('"begin"', res)
+  assertNotMatch('"end"', res)
+end
+
+function should.bindBeginEndWithoutIter()
+  local Segment = ins:find('Segment')
+  assertNil(binder:iterable(Segment))
+  local res = binder:bindClass(Segment)
+  assertMatch('"begin" *, Segment_begin', res)
+  assertMatch('"end" *, Segment_end', res)
+  assertNotMatch('"iter"', res)
+end
+
+function should.notIterateWithoutSize()
+  local Withgc = ins:find('Withgc')
+  assertNil(binder:iterable(Withgc))
+  local res = binder:bindClass(Withgc)
+  assertNotMatch('__pairs', res)
+end
+
 --=============================================== Build
 
 function should.bindCompileAndLoad()
@@ -88,6 +301,20 @@ function should.bindCompileAndLoad()
         lub.path '|tmp/dub/dub.cpp',
         lub.path '|tmp/mem_Nogc.cpp',
         lub.path '|tmp/mem_Withgc.cpp',
+        lub.path '|tmp/mem_Foreign.cpp',
+        lub.path '|tmp/mem_Pooled.cpp',
+        lub.path '|tmp/mem_Arena.cpp',
+        lub.path '|tmp/mem_Series.cpp',
+        lub.path '|tmp/mem_Samples.cpp',
+        lub.path '|tmp/mem_Segment.cpp',
+        lub.path '|tmp/mem_Image.cpp',
+        lub.path '|tmp/mem_Canvas.cpp',
+        lub.path '|tmp/mem_Counted.cpp',
+        lub.path '|tmp/mem_Asset.cpp',
+        lub.path '|tmp/mem_Texture.cpp',
+        lub.path '|tmp/mem_Cache.cpp',
+        lub.path '|tmp/mem_Node.cpp',
+        lub.path '|tmp/mem_Handle.cpp',
         lub.path '|tmp/mem_Union.cpp',
         lub.path '|tmp/mem_Pen.cpp',
         lub.path '|tmp/mem_Owner.cpp',
@@ -104,6 +331,8 @@ function should.bindCompileAndLoad()
         lub.path '|tmp/dub',
         lub.path '|fixtures/memory',
       },
+      -- std::shared_ptr
+      flags = '-std=c++11',
     }
     package.cpath = tmp_path .. '/?.so'
     --require 'Box'
@@ -153,9 +382,318 @@ function should.createAndDestroy()
     runGcTest(mem.Nogc.new,   "__gc optimization:      create and destroy 100'000 elements: %.2f ms.")
     runGcTest(mem.Withgc.new, "Normal __gc:            create and destroy 100'000 elements: %.2f ms.")
     runGcTest(mem.Withgc,     "Normal __gc and __call: create and destroy 100'000 elements: %.2f ms.")
+    runGcTest(mem.Pooled.new, "Pool allocator:         create and destroy 100'000 elements: %.2f ms.")
   else
     runGcTest(mem.Nogc.new)
     runGcTest(mem.Withgc.new)
+    runGcTest(mem.Pooled.new)
+  end
+end
+
+function should.notTrustForeignUserdata()
+  local f = mem.Foreign.forge()
+  assertError('expected mem.Withgc, found userdata', function()
+    mem.Withgc.surface(f)
+  end)
+  assertError('expected mem.Withgc, found userdata', function()
+    return mem.Withgc(1, 2) + f
+  end)
+end
+
+--=============================================== Pool allocator
+
+function should.countPooledObjects()
+  collectgarbage()
+  collectgarbage()
+  local live = mem.Pooled._pool_().live
+  local t = {}
+  for i = 1,100 do
+    t[i] = mem.Pooled(i, 2)
+  end
+  local stats = mem.Pooled._pool_()
+  assertEqual(live + 100, stats.live)
+  assertTrue(stats.high_water >= stats.live)
+  assertTrue(stats.bytes > 0)
+  assertEqual(200, t[100]:surface())
+  t = nil
+  collectgarbage()
+  collectgarbage()
+  assertEqual(live, mem.Pooled._pool_().live)
+end
+
+function should.deleteObjectsNotAllocatedInPool()
+  collectgarbage()
+  collectgarbage()
+  local live = mem.Pooled._pool_().live
+  local a = mem.Pooled(1, 2)
+  -- Return by value is allocated with new.
+  local b = a + mem.Pooled(3, 4)
+  assertEqual(24, b:surface())
+  a = nil
+  b = nil
+  collectgarbage()
+  collectgarbage()
+  assertEqual(live, mem.Pooled._pool_().live)
+end
+
+--=============================================== Allocator
+
+function should.countMemoryWithAllocator()
+  local a = mem.Arena()
+  local stats = a:stats()
+  assertEqual(a:used(), stats.bytes)
+  assertEqual(0, stats.limit)
+  assertEqual(10, #stats.classes)
+  assertEqual(16, stats.classes[1].size)
+  assertTrue(a:run 'x = {} for i=1,1000 do x[i] = {i} end')
+  local s2 = a:stats()
+  assertEqual(a:used(), s2.bytes)
+  assertTrue(s2.bytes > stats.bytes + 1000 * 32)
+  assertTrue(s2.peak >= s2.bytes)
+  assertTrue(s2.reserved >= s2.bytes)
+  assertTrue(a:run 'x = nil')
+end
+
+function should.trimEmptyChunks()
+  local a = mem.Arena()
+  assertTrue(a:run 'x = {} for i=1,10000 do x[i] = {i} end')
+  local s1 = a:stats()
+  assertTrue(a:run 'x = nil')
+  assertTrue(a:trim() > 0)
+  local s2 = a:stats()
+  assertTrue(s2.reserved < s1.reserved / 2)
+  assertTrue(s2.reserved >= s2.bytes)
+  -- Memory can be reused after trim.
+  assertTrue(a:run 'x = {} for i=1,1000 do x[i] = {i} end')
+  assertEqual(a:used(), a:stats().bytes)
+end
+
+function should.failAboveMemoryLimit()
+  local a = mem.Arena(64 * 1024)
+  assertFalse(a:run 'local t = {} for i=1,100000 do t[i] = {} end')
+  local stats = a:stats()
+  assertTrue(stats.peak <= 64 * 1024)
+  -- The state is still usable.
+  assertTrue(a:run 'x = {1, 2, 3}')
+end
+
+--=============================================== Native memory
+
+function should.countNativeMemory()
+  collectgarbage()
+  collectgarbage()
+  local stats = mem.Image.gcstats()
+  local img = mem.Image(256, 256)
+  local s2 = mem.Image.gcstats()
+  assertEqual(stats.bytes + 256 * 256 * 4, s2.bytes)
+  assertEqual(stats.objects + 1, s2.objects)
+  assertTrue(s2.peak >= s2.bytes)
+  img = nil
+  collectgarbage()
+  collectgarbage()
+  local s3 = mem.Image.gcstats()
+  assertEqual(stats.bytes, s3.bytes)
+  assertEqual(stats.objects, s3.objects)
+end
+
+function should.collectObjectsHoldingNativeMemory()
+  collectgarbage()
+  collectgarbage()
+  local live = mem.Image.live()
+  local max = 0
+  for i = 1, 500 do
+    -- 1 MB of pixels, a few bytes seen by Lua.
+    local img = mem.Image(512, 512)
+    max = math.max(max, mem.Image.live() - live)
+  end
+  -- Without reported memory, the loop would not trigger a collection.
+  assertTrue(max < 100)
+  assertTrue(mem.Image.gcstats().steps > 0)
+  collectgarbage()
+  collectgarbage()
+  assertEqual(live, mem.Image.live())
+end
+
+function should.releaseNativeMemoryOfObjectsDeletedInCpp()
+  collectgarbage()
+  collectgarbage()
+  local bytes = mem.Image.gcstats().bytes
+  local c = mem.Canvas(10)
+  assertEqual(bytes + 10 * 1024, mem.Image.gcstats().bytes)
+  mem.Canvas.kill(c)
+  assertTrue(c:deleted())
+  c = nil
+  collectgarbage()
+  collectgarbage()
+  assertEqual(bytes, mem.Image.gcstats().bytes)
+end
+
+--=============================================== std::shared_ptr
+
+function should.shareObjectsWithCpp()
+  collectgarbage()
+  collectgarbage()
+  local live = mem.Asset.live()
+  local cache = mem.Cache()
+  local t = mem.Texture(7)
+  -- Upcast to std::shared_ptr<Asset>
+  cache:add(t)
+  assertEqual(2, cache:useCount(0))
+  t = nil
+  collectgarbage()
+  collectgarbage()
+  -- Referenced by the cache
+  assertEqual(live + 1, mem.Asset.live())
+  assertEqual(1, cache:useCount(0))
+  local a = cache:get(0)
+  assertEqual(7, a:id())
+  assertEqual(2, cache:useCount(0))
+  assertNil(cache:get(5))
+  cache:clear()
+  -- Referenced by Lua
+  assertEqual(7, a:id())
+  a = nil
+  collectgarbage()
+  collectgarbage()
+  assertEqual(live, mem.Asset.live())
+end
+
+function should.notShareObjectsWithoutSharedPtr()
+  local cache = mem.Cache()
+  local a = mem.Asset(1)
+  assertError('held by std::shared_ptr', function()
+    cache:add(a)
+  end)
+end
+
+--=============================================== Object statistics
+
+function should.countObjects()
+  collectgarbage()
+  collectgarbage()
+  local stats = mem.Counted._stats_()
+  local a = mem.Counted(1)
+  local b = a + mem.Counted(2)
+  local s2 = mem.Counted._stats_()
+  assertEqual(stats.live + 3, s2.live)
+  assertEqual(stats.created + 3, s2.created)
+  assertTrue(s2.bytes >= s2.live * 8)
+  -- borrowed
+  local c = a:self()
+  assertEqual(1, c.x)
+  a, b, c = nil
+  collectgarbage()
+  collectgarbage()
+  local s3 = mem.Counted._stats_()
+  assertEqual(stats.live, s3.live)
+  assertEqual(stats.owned + 3, s3.owned)
+  assertEqual(stats.borrowed + 1, s3.borrowed)
+  -- All classes
+  local all = mem.Counted.stats()
+  assertEqual(s3.created, all['mem.Counted'].created)
+  assertNil(all['mem.Withgc'])
+end
+
+--=============================================== Reference count
+
+function should.retainAndReleaseObjects()
+  collectgarbage()
+  collectgarbage()
+  local live = mem.Node.live()
+  local a = mem.Node(1)
+  assertEqual(1, a:refs())
+  local b = a:self()
+  assertEqual(2, a:refs())
+  b = nil
+  collectgarbage()
+  collectgarbage()
+  assertEqual(1, a:refs())
+  local n = mem.Node(2)
+  a.next = n
+  assertEqual(2, n:refs())
+  n = nil
+  collectgarbage()
+  collectgarbage()
+  -- Referenced by a.next
+  assertEqual(live + 2, mem.Node.live())
+  assertEqual(2, a.next:value())
+  -- Releases the previous node.
+  a.next = mem.Node(3)
+  collectgarbage()
+  collectgarbage()
+  assertEqual(live + 2, mem.Node.live())
+  assertEqual(3, a.next:value())
+  a = nil
+  collectgarbage()
+  collectgarbage()
+  assertEqual(live, mem.Node.live())
+end
+
+--=============================================== Iteration
+
+local function sum(iter, obj)
+  local res = 0
+  for i, v in iter(obj) do
+    res = res + v
+  end
+  return res
+end
+
+function should.iterateOverSeries()
+  local s = mem.Series(4)
+  -- Methods are found with operator[] and without attributes.
+  assertEqual(4, s:size())
+  assertEqual(2, s[1])
+  local t = {}
+  for i, v in s:iter() do
+    t[i] = v
+  end
+  assertValueEqual({0, 2, 4, 6}, t)
+  assertEqual(0, sum(mem.Series.iter, mem.Series(0)))
+end
+
+function should.iterateOverRange()
+  local s = mem.Samples(3)
+  local t = {}
+  for i, v in s:iter() do
+    t[i] = v
+  end
+  assertValueEqual({0.5, 1.5, 2.5}, t)
+  -- The cursor keeps the object alive.
+  local f, c = mem.Samples(2):iter()
+  collectgarbage()
+  collectgarbage()
+  assertEqual(0.5, select(2, f(c)))
+  assertEqual(1.5, select(2, f(c)))
+  assertNil(f(c))
+end
+
+function should.callBeginEndWithoutIter()
+  local s = mem.Segment()
+  assertType('userdata', s:begin())
+  assertNil(s['end'](s))
+  assertNil(s.iter)
+end
+
+function should.iterateWithoutGarbage()
+  local s, r = mem.Series(100000), mem.Samples(100000)
+  sum(mem.Series.iter, s)
+  sum(mem.Samples.iter, r)
+  collectgarbage()
+  collectgarbage('stop')
+  local vm_size = collectgarbage('count')
+  local start = elapsed()
+  assertEqual(9999900000, sum(mem.Series.iter, s))
+  local t1 = elapsed() - start
+  assertEqual(5000000000, sum(mem.Samples.iter, r))
+  local t2 = elapsed() - start - t1
+  -- O(1) garbage for 200'000 elements (a userdata per element would be
+  -- several MB).
+  assertEqual(vm_size, collectgarbage('count'), 10)
+  collectgarbage('restart')
+  if test_speed then
+    printf("size/operator[]: iterate 100'000 elements: %.2f ms.", t1)
+    printf("begin/end:       iterate 100'000 elements: %.2f ms.", t2)
   end
 end
 
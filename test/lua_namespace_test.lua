@@ -20,6 +20,11 @@ binder:parseCustomBindings(lub.path '|fixtures/namespace')
 
 local ins, moo
 
+-- Pattern matching the dub::Type used for 'mt_name' in the last generated code.
+local function typeRef(mt_name)
+  return (string.gsub(binder:typeRef(mt_name), '[%[%]]', '%%%0'))
+end
+
 function should.setup()
   dub.warn = dub.silentWarn
   if not ins then
@@ -45,14 +50,15 @@ end
 function should.useFullnameInMetaName()
   local A = ins:find('Nem::A')
   local res = binder:bindClass(A)
-  assertMatch('dub::pushudata%(L, retval__, "Nem.A", true%);', res)
+  assertMatch('{ "Nem.A" +, 1, 0x%x+, NULL, NULL },', res)
+  assertMatch('dub::pushudata%(L, retval__, '..typeRef('Nem.A')..', true%);', res)
 end
 
 function should.bindGlobalFunction()
   local met = ins:find('Nem::addTwo')
   local res = binder:functionBody(met)
-  assertMatch('B %*a = %*%(%(B %*%*%)dub::checksdata%(L, 1, "Nem.B"%)%);', res)
-  assertMatch('B %*b = %*%(%(B %*%*%)dub::checksdata%(L, 2, "Nem.B"%)%);', res)
+  assertMatch('B %*a = %(%(B %*%)dub::checksdata%(L, 1, '..typeRef('Nem.B')..'%)%);', res)
+  assertMatch('B %*b = %(%(B %*%)dub::checksdata%(L, 2, '..typeRef('Nem.B')..'%)%);', res)
   assertMatch('lua_pushnumber%(L, Nem::addTwo%(%*a, %*b%)%);', res)
 end
 
@@ -69,8 +75,8 @@ end
 function should.bindGlobalFunctionNotInNamespace()
   local met = ins:find('addTwoOut')
   local res = binder:functionBody(met)
-  assertMatch('B %*a = %*%(%(B %*%*%)dub::checksdata%(L, 1, "Nem.B"%)%);', res)
-  assertMatch('B %*b = %*%(%(B %*%*%)dub::checksdata%(L, 2, "Nem.B"%)%);', res)
+  assertMatch('B %*a = %(%(B %*%)dub::checksdata%(L, 1, '..typeRef('Nem.B')..'%)%);', res)
+  assertMatch('B %*b = %(%(B %*%)dub::checksdata%(L, 2, '..typeRef('Nem.B')..'%)%);', res)
   assertMatch('lua_pushnumber%(L, addTwoOut%(%*a, %*b%)%);', res)
 end
 
@@ -104,7 +110,7 @@ function should.useFullnameInCtor()
   local res = binder:functionBody(met)
   assertMatch('B::C %*retval__', res)
   assertMatch('new B::C%(', res)
-  assertMatch('dub::pushudata%(L, retval__, "Nem.B.C", true%);', res)
+  assertMatch('dub::pushudata%(L, retval__, '..typeRef('Nem.B.C')..', true%);', res)
 end
 
 function should.properlyResolveReturnTypeInMethod()
@@ -112,7 +118,20 @@ function should.properlyResolveReturnTypeInMethod()
   local met = C:method('getC')
   local res = binder:functionBody(met)
   assertMatch('B::C %*retval__ = self%->getC%(%);', res)
-  assertMatch('dub::pushudata%(L, retval__, "Nem.B.C", false%);', res)
+  assertMatch('dub::pushudata%(L, retval__, '..typeRef('Nem.B.C')..', false%);', res)
+end
+
+function should.bindOperatorVariantsWithNamespacedReturnType()
+  local B   = ins:find('Nem::B')
+  local met = B:method('add_into')
+  -- One variant per overload of operator+.
+  assertEqual(2, #met.overloaded)
+  local res = binder:functionBody(met)
+  assertMatch('%*out = self%->operator%+%(%*other%);', res)
+  assertMatch('%*out = self%->operator%+%(n%);', res)
+  res = binder:functionBody(B:method('add_assign'))
+  assertMatch('%*self = self%->operator%+%(%*other%);\n *lua_pushvalue%(L, 1%);', res)
+  assertMatch('%*self = self%->operator%+%(n%);', res)
 end
 
 function should.properlyResolveTypeInGetAttr()
@@ -121,7 +140,7 @@ function should.properlyResolveTypeInGetAttr()
   local res = binder:functionBody(met)
   assertMatch('B::C %*retval__', res)
   assertMatch('new B::C%(', res)
-  assertMatch('dub::pushudata%(L, retval__, "Nem.B.C", true%);', res)
+  assertMatch('dub::pushudata%(L, retval__, '..typeRef('Nem.B.C')..', true%);', res)
 end
 
 --=============================================== Build
@@ -253,6 +272,17 @@ function should.findNestedClass()
   assertEqual(456, b.nb_)
 end
 
+function should.writeNamespacedOperatorsInPlace()
+  local a, b, out = moo.B(1), moo.B(2), moo.B(0)
+  assertEqual(3, (a + b).nb_)
+  assertEqual(out, a:add_into(b, out))
+  assertEqual(3, out.nb_)
+  a:add_into(5, out)
+  assertEqual(6, out.nb_)
+  a:add_assign(b):add_assign(1)
+  assertEqual(4, a.nb_)
+end
+
 function should.useCustomAccessor()
   local a = moo.A()
   local watch = moo.Vect(0,0)
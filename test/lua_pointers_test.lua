@@ -23,6 +23,7 @@ local should = lut.Test('dub.LuaBinder - pointers', {coverage = false})
 
 local path = lub.path
 local binder = dub.LuaBinder()
+local elapsed = function() return 0 end
 
 local ins = dub.Inspector {
   INPUT    = path '|fixtures/pointers',
@@ -48,6 +49,71 @@ function should.resolveStdString()
   assertMatch('const char %*name = dub::checklstring%(L, 1, %&name_sz_%);', res)
 end
 
+function should.passLstringWithoutCopy()
+  local Box = ins:find('Box')
+  local met = Box:method('setName')
+  local res = binder:functionBody(Box, met)
+  assertMatch('const char %*data = dub::checklstring%(L, 2, %&data_sz_%);', res)
+  assertMatch('self%->setName%(data, data_sz_%);', res)
+end
+
+function should.resolveStdStringView()
+  local lua = binder.TYPE_TO_CHECK['std::string_view']
+  assertEqual('string', lua.type)
+  assertEqual('std::string_view(name, name_sz_)', lua.cast('name'))
+  assertEqual('lua_pushlstring(L, name.data(), name.size());', lua.push('name'))
+end
+
+function should.convertStdVector()
+  local Box = ins:find('Box')
+  local res = binder:functionBody(Box, Box:method('scale'))
+  assertMatch('std::vector< double > values;\n *dub::checkseq%(L, 2, values%);', res)
+  assertMatch('dub::pushseq%(L, self%->scale%(values, s%)%);', res)
+  res = binder:functionBody(Box, Box:method('repeatName'))
+  assertMatch('dub::pushseq%(L, self%->repeatName%(count%)%);', res)
+end
+
+function should.convertArrayParams()
+  local Box = ins:find('Box')
+  local res = binder:functionBody(Box, Box:method('sum'))
+  assertMatch('std::vector< double > values;\n *dub::checkseq%(L, 2, values%);', res)
+  assertMatch('self%->sum%(%(values.empty%(%) %? NULL : &values%[0%]%), values.size%(%)%)', res)
+end
+
+function should.pushContainerAttributesAsViews()
+  local Box = ins:find('Box')
+  local res = binder:functionBody(Box, Box:method(Box.GET_ATTR_NAME))
+  assertMatch('dub::pushview%(L, %(std::vector< double > %*%)&self%->samples, dub_types%[%d%]%);\n *dub::protect%(L, lua_gettop%(L%), 1, "_"%);', res)
+  assertMatch('dub::pushview%(L, %(std::map< std::string, double > %*%)&self%->props, dub_types%[%d%]%);', res)
+  res = binder:functionBody(Box, Box:method(Box.SET_ATTR_NAME))
+  assertMatch('dub::checkseq%(L, 3, samples%);\n *self%->samples = samples;', res)
+end
+
+function should.pushContainerReferencesAsViews()
+  local Box = ins:find('Box')
+  local res = binder:functionBody(Box, Box:method('constSamples'))
+  assertMatch('dub::pushview%(L, %(const std::vector< double > %*%)&self%->constSamples%(%), dub_types%[%d%]%);', res)
+  res = binder:functionBody(Box, Box:method('propsRef'))
+  assertMatch('dub::pushview%(L, %(std::map< std::string, double > %*%)&self%->propsRef%(%), ', res)
+end
+
+function should.declareViewMetatablesPerLibrary()
+  local Box = ins:find('Box')
+  local res = binder:bindClass(Box)
+  assertMatch('{ "Box.SeqView<std::vector< double >>", %d+, 0x%x+, NULL, dub::SeqView< std::vector< double > >::rw },', res)
+  assertMatch('{ "Box.SeqView<std::vector< double >> const", %d+, 0x%x+, NULL, dub::SeqView< std::vector< double > >::ro },', res)
+  assertMatch('{ "Box.MapView<std::map< std::string, double >>", %d+, 0x%x+, NULL, dub::MapView< std::map< std::string, double > >::rw },', res)
+  assertNotMatch('"dub%.SeqView', res)
+end
+
+function should.pushBuffers()
+  local Box = ins:find('Box')
+  local res = binder:functionBody(Box, Box:method('nameBytes'))
+  assertMatch('const unsigned char %*retval__ = self%->nameBytes%(%);\n *if %(!retval__%) return 0;\n *dub::pushbuffer%(L, retval__, self%->nameSize%(%)%);\n *dub::protect%(L, lua_gettop%(L%), 1, "_"%);', res)
+  res = binder:functionBody(Box, Box:method('samplesBuffer'))
+  assertMatch('dub::pushbuffer%(L, self%->samplesBuffer%(%)%);\n *dub::protect', res)
+end
+
 function should.notGcReturnedPointer()
   local Box = ins:find('Box')
   local met = Box:method('size')
@@ -64,6 +130,53 @@ function should.gcReturnedPointerMarkedAsGc()
   assertMatch('pushudata[^\n]+, true%);', res)
 end
 
+function should.pushCachedPointersWithIdentity()
+  local Box = ins:find('Box')
+  local ibinder = dub.LuaBinder {identity = true}
+  local res = ibinder:functionBody(Box, Box:method('size'))
+  assertMatch('dub::pushcached%(L, retval__, dub_types%[%d%], false%);', res)
+  res = ibinder:functionBody(Box, Box:method('sizeRef'))
+  assertMatch('dub::pushcached%(L, &', res)
+  local Vect = ins:find('Vect')
+  -- copies are new objects
+  res = ibinder:functionBody(Vect, Vect:method('operator+'))
+  assertMatch('dub::pushudata%(L, new Vect', res)
+  res = ibinder:bindClass(Vect)
+  assertMatch('dub::identity%(L%);', res)
+end
+
+function should.bindOperatorsWithoutAllocation()
+  local Vect = ins:find('Vect')
+  local res = binder:functionBody(Vect, Vect:method('add_into'))
+  assertMatch('%*out = self%->operator%+%(%*v%);\n *lua_pushvalue%(L, 3%);\n *return 1;', res)
+  assertNotMatch('new Vect', res)
+  -- Uses operator+=
+  res = binder:functionBody(Vect, Vect:method('add_assign'))
+  assertMatch('self%->operator%+=%(%*v%);\n *lua_pushvalue%(L, 1%);', res)
+  -- No operator*=
+  res = binder:functionBody(Vect, Vect:method('mul_assign'))
+  assertMatch('%*self = self%->operator%*%(d%);', res)
+  res = binder:functionBody(Vect, Vect:method('div_into'))
+  assertMatch('%*out = self%->operator/%(d%);', res)
+end
+
+function should.buildObjectsInUserdataWithInlineStorage()
+  local Vect = ins:find('Vect')
+  local sbinder = dub.LuaBinder {storage = 'inline'}
+  local res = sbinder:functionBody(Vect, Vect:method('Vect'))
+  assertMatch('DubUserdata %*udata__ = dub::newudata<Vect>%(L, dub_types%[0%]%);', res)
+  assertMatch('new%(udata__%->ptr%) Vect%(tx, ty%);', res)
+  assertMatch('udata__%->gc = true;', res)
+  res = sbinder:functionBody(Vect, Vect:method('operator+'))
+  assertMatch('new%(udata__%->ptr%) Vect%(%(self%->operator%+%(%*v%)%)%);', res)
+  res = sbinder:functionBody(Vect, Vect:method('~Vect'))
+  assertMatch('if %(dub::isinline<Vect>%(userdata%)%) {\n *self%->~Vect%(%);\n *} else {\n *delete self;', res)
+  -- pointers returned by methods are not owned
+  local Box = ins:find('Box')
+  res = sbinder:functionBody(Box, Box:method('copySize'))
+  assertMatch('dub::pushudata%(L, retval__, dub_types%[%d%], true%);', res)
+end
+
 function should.notBindCtorInAbstractType()
   local Abstract = ins:find('Abstract')
   local res = binder:bindClass(Abstract)
@@ -117,7 +230,7 @@ function should.bindComplexSetMethod()
   assertMatch('__newindex.*Box__set_', res)
   local set = Box:method(Box.SET_ATTR_NAME)
   local res = binder:functionBody(Box, set)
-  assertMatch('self%->size_ = %*%*%(%(Vect %*%*%)', res)
+  assertMatch('self%->size_ = %*%(%(Vect %*%)', res)
 end
 
 function should.ignoreArrayAttrInSet()
@@ -138,6 +251,23 @@ function should.ignoreArrayAttrInGet()
   assertNotMatch('self%->d', res)
 end
 
+function should.bindArraySliceMethods()
+  local Vect = ins:find('Vect')
+  local res = binder:bindClass(Vect)
+  assertMatch('"d_slice".*Vect_d_slice', res)
+  res = binder:functionBody(Vect, Vect:method('d_slice'))
+  assertMatch('return dub::readarray%(L, self%->d, MAX_DIM, 2%);', res)
+  res = binder:functionBody(Vect, Vect:method('d_setslice'))
+  assertMatch('return dub::writearray%(L, self%->d, MAX_DIM, 2%);', res)
+  res = binder:functionBody(Vect, Vect:method('d_fill'))
+  assertMatch('return dub::fillarray%(L, self%->d, MAX_DIM, 2%);', res)
+  res = binder:functionBody(Vect, Vect:method('d_copy'))
+  assertMatch('Vect %*other = %(Vect %*%)dub::checksdata%(L, 2, dub_types%[%d+%]%);', res)
+  assertMatch('self%->d%[i%] = other%->d%[i%];', res)
+  res = binder:functionBody(Vect, Vect:method('d_buffer'))
+  assertMatch('dub::pushbuffer%(L, self%->d, MAX_DIM%);\n *dub::protect%(L, lua_gettop%(L%), 1, "_"%);', res)
+end
+
 function should.bindSimpleGetMethod()
   -- __newindex for simple (native) types
   local Vect = ins:find('Vect')
@@ -157,7 +287,7 @@ function should.bindComplexGetMethod()
   local res = binder:bindClass(Box)
   assertMatch('__index.*Box__get_', res)
   local res = binder:functionBody(Box, set)
-  assertMatch('self%->size_ = %*%*%(%(Vect %*%*%)', res)
+  assertMatch('self%->size_ = %*%(%(Vect %*%)', res)
 end
 
 --=============================================== Custom set/get
@@ -168,15 +298,17 @@ function should.bindCustomGetSet()
   -- First bind class to ensure type resolution and method
   -- generation is done.
   local res = binder:bindClass(Custom)
+  assertMatch('static const char %*const dub_keys%[%] = {\n  "url",', res)
+  assertMatch('dub::fregister%(L, Custom_member_methods, dub_types, dub_keys%);', res)
 
   local met = Custom:method(Custom.GET_ATTR_NAME)
   local res = binder:functionBody(Custom, met)
-  assertMatch('DUB_ASSERT_KEY%(key, "url"%)', res)
+  assertMatch('switch%(dub::keyindex%(L, 2%)%) {\n  case 1: {\n    // url', res)
   assertMatch('self%->getUrl%(%).data%(%)', res)
 
   met = Custom:method(Custom.SET_ATTR_NAME)
   res = binder:functionBody(Custom, met)
-  assertMatch('DUB_ASSERT_KEY%(key, "url"%)', res)
+  assertMatch('case 1: {\n    // url', res)
   assertMatch('self%->setUrl%(std::string%(url, url_sz_%)%);', res)
 end
 
@@ -189,7 +321,7 @@ function should.useProperDeltaInCustomSet()
 
   met = Custom:method(Custom.SET_ATTR_NAME)
   res = binder:functionBody(Custom, met)
-  assertMatch('DUB_ASSERT_KEY%(key, "url"%)', res)
+  assertMatch('case 1: {\n    // url', res)
   assertMatch('url = dub::checklstring%(L, 3', res)
 end
 
@@ -468,6 +600,62 @@ function should.writeArrayAttributes()
   assertEqual(10, v:d(1))
 end
 
+function should.readArraySlices()
+  local v = Vect(1,2)
+  assertValueEqual({4, 5, 6}, v:d_slice())
+  assertValueEqual({5, 6}, v:d_slice(2))
+  assertValueEqual({4, 5}, v:d_slice(1, 2))
+  assertNil(v:d_slice(0, 2))
+  assertNil(v:d_slice(2, 4))
+  -- reuse table
+  local t = {}
+  assertEqual(t, v:d_slice(1, 3, t))
+  assertValueEqual({4, 5, 6}, t)
+end
+
+function should.writeArraySlices()
+  local v = Vect(1,2)
+  v:d_setslice {10, 20}
+  assertValueEqual({10, 20, 6}, v:d_slice())
+  v:d_setslice({30}, 3)
+  assertValueEqual({10, 20, 30}, v:d_slice())
+  -- does not fit: ignored
+  v:d_setslice({1, 2}, 3)
+  assertValueEqual({10, 20, 30}, v:d_slice())
+  assertError('bad element 2 in argument #2 %(expected number, found string%)', function()
+    v:d_setslice {1, 'x'}
+  end)
+end
+
+function should.fillAndCopyArrays()
+  local v, w = Vect(1,2), Vect(3,4)
+  v:d_fill(7)
+  assertValueEqual({7, 7, 7}, v:d_slice())
+  v:d_fill()
+  assertValueEqual({0, 0, 0}, v:d_slice())
+  v:d_copy(w)
+  assertValueEqual({8, 9, 10}, v:d_slice())
+end
+
+function should.accessArraysThroughBuffers()
+  local v = Vect(1,2)
+  local b = v:d_buffer()
+  assertEqual(3, #b)
+  assertEqual('double', b:ctype())
+  assertEqual(5, b[2])
+  b[2] = 50
+  assertEqual(50, v:d(2))
+  assertNil(b[4])
+  assertError('out of range', function()
+    b[4] = 1
+  end)
+  -- The buffer keeps the owner alive.
+  v = nil
+  collectgarbage()
+  collectgarbage()
+  assertEqual(50, b[2])
+end
+
 function should.accessStaticAttributes()
   local t, v = Vect(1,1), Vect(1,1)
   -- Access static members through members.
@@ -605,6 +793,64 @@ function should.overloadSube()
   assertEqual(1, b.x)
   assertEqual(2, b.y)
 end
+function should.writeOperatorsInPlace()
+  local a, b, out = Vect(1, 2), Vect(3, 4), Vect(0, 0)
+  assertEqual(out, a:add_into(b, out))
+  assertEqual(4, out.x)
+  assertEqual(6, out.y)
+  a:sub_into(b, out)
+  assertEqual(-2, out.x)
+  -- out can be an operand
+  a:mul_into(2, a)
+  assertEqual(2, a.x)
+  assertEqual(4, a.y)
+  a:div_into(2, out)
+  assertEqual(1, out.x)
+  -- chained in place operations
+  a:add_assign(b):mul_assign(2)
+  assertEqual(10, a.x)
+  assertEqual(16, a.y)
+  a:sub_assign(b):div_assign(2)
+  assertEqual(3.5, a.x)
+  assertEqual(6, a.y)
+  assertError('expected Vect, found nil', function()
+    a:add_into(b)
+  end)
+end
+
+local function addMany(a, b, out)
+  local start = elapsed()
+  for i = 1, 100000 do
+    out = a + b * 2
+  end
+  return elapsed() - start
+end
+
+local function addManyInPlace(a, b, out)
+  local start = elapsed()
+  for i = 1, 100000 do
+    b:mul_into(2, out)
+    a:add_into(out, out)
+  end
+  return elapsed() - start
+end
+
+function should.notAllocateInPlace()
+  local a, b, out = Vect(1, 2), Vect(3, 4), Vect(0, 0)
+  addManyInPlace(a, b, out)
+  collectgarbage()
+  collectgarbage('stop')
+  local vm_size = collectgarbage('count')
+  local t = addManyInPlace(a, b, out)
+  assertEqual(vm_size, collectgarbage('count'), 10)
+  collectgarbage('restart')
+  assertEqual(7, out.x)
+  if test_speed then
+    printf("a + b * 2:              100'000 operations: %.2f ms.", addMany(a, b, out))
+    printf("mul_into and add_into:  100'000 operations: %.2f ms.", t)
+  end
+end
+
 --=============================================== Box
 
 function should.createBoxObject()
@@ -686,6 +932,17 @@ function should.writeBoxAttributes()
   assertEqual(12, v:surface())
 end
 
+function should.accessAttributesWithLongNames()
+  local b = Box('Cat')
+  -- Lua 5.2+ does not intern the key (lookup by content).
+  assertEqual(0, b.long_attribute_name_that_lua_does_not_intern)
+  b.long_attribute_name_that_lua_does_not_intern = 4.5
+  assertEqual(4.5, b.long_attribute_name_that_lua_does_not_intern)
+  assertError("invalid key 'long_attribute_name_that_lua_does_not_internx'", function()
+    b.long_attribute_name_that_lua_does_not_internx = 1
+  end)
+end
+
 function should.returnNilOnNullPointer()
   local b = Box('any')
   assertNil(b.position)
@@ -802,6 +1059,103 @@ function should.handleBinaryData()
   assertNotEqual('One', b.name_)
 end
 
+function should.convertTablesAndVectors()
+  local b = Box('Cat', Vect(1,2))
+  assertValueEqual({2, 4, 6}, b:scale({1, 2, 3}, 2))
+  assertValueEqual({}, b:scale({}, 2))
+  assertEqual(6, b:sum {1, 2, 3})
+  assertEqual(0, b:sum {})
+  assertValueEqual({'Cat', 'Cat'}, b:repeatName(2))
+  assertError('scale: bad element 2 in argument #2 %(expected number, found string%)', function()
+    b:scale({1, 'x'}, 2)
+  end)
+  assertError('sum: expected table, found number', function()
+    b:sum(4)
+  end)
+end
+
+function should.accessContainersThroughViews()
+  local b = Box('Cat', Vect(1,2))
+  b.samples = {1, 2, 3}
+  local s = b.samples
+  assertEqual('userdata', type(s))
+  assertEqual(3, #s)
+  assertEqual(2, s[2])
+  assertNil(s[4])
+  s[2] = 20
+  s[4] = 4
+  assertEqual(4, #s)
+  local t = {}
+  for i, v in s() do
+    t[i] = v
+  end
+  assertValueEqual({1, 20, 3, 4}, t)
+  local c = b:constSamples()
+  assertEqual(20, c[2])
+  assertError('read%-only', function()
+    c[1] = 5
+  end)
+  -- The view keeps the owner alive.
+  b = nil
+  collectgarbage()
+  collectgarbage()
+  assertEqual(4, #s)
+end
+
+function should.accessMapsThroughViews()
+  local b = Box('Cat', Vect(1,2))
+  local p = b.props
+  p.a = 1.5
+  p.b = 2
+  assertEqual(2, #p)
+  assertEqual(1.5, b:propsRef().a)
+  assertNil(p.c)
+  p.a = nil
+  assertEqual(1, #p)
+  local t = {}
+  for k, v in p() do
+    t[k] = v
+  end
+  assertValueEqual({b = 2}, t)
+end
+
+function should.accessMemoryThroughBuffers()
+  local b = Box('Cat', Vect(1,2))
+  local n = b:nameBytes()
+  assertEqual(3, #n)
+  assertEqual(string.byte('C'), n[1])
+  assertEqual('Cat', n:getbytes())
+  assertEqual('at', n:getbytes(2))
+  assertError('read%-only', function()
+    n[1] = 65
+  end)
+  b.samples = {1, 2, 3}
+  local s = b:samplesBuffer()
+  assertEqual(3, #s)
+  assertEqual(8, s:stride())
+  assertEqual('userdata', type(s:ptr()))
+  s[3] = 30
+  assertEqual(30, b.samples[3])
+  -- Bulk copy through strings.
+  local bytes = s:getbytes(1, 2)
+  assertEqual(16, #bytes)
+  s:setbytes(bytes, 2)
+  assertValueEqual({1, 1, 2}, {s[1], s[2], s[3]})
+  assertError('do not fit', function()
+    s:setbytes(bytes, 3)
+  end)
+end
+
+function should.passBinaryDataAsLstring()
+  local b = Box('Cat', Vect(1,2))
+  local data = 'Hello\0 World'
+  b:setName(data)
+  assertEqual(data, b:name())
+  assertError('setName: expected string, found nil', function()
+    b:setName()
+  end)
+end
+
 --=============================================== Return value opt.
 function should.optimizeReturnValue()
   collectgarbage()
@@ -900,5 +1254,268 @@ function should.useFormatInToString()
   assertMatch(m, b:__tostring())
 end
 
+--=============================================== Lua __index
+
+function should.findMethodsBeforeCIndex()
+  local Vect = ins:find('Vect')
+  local lbinder = dub.LuaBinder {index = 'lua'}
+  local res = lbinder:bindClass(Vect)
+  assertMatch('dub::luaindex%(L%);', res)
+  local met = Vect:method(Vect.GET_ATTR_NAME)
+  res = lbinder:functionBody(Vect, met)
+  assertMatch('dub::checksdata_n%(L, 1, dub_types%[0%]%);', res)
+  assertNotMatch('lua_rawget', res)
+end
+
+local lVect
+
+function should.bindCompileAndLoadWithLuaIndex()
+  local tmp_path = path '|tmp'
+  local ins = dub.Inspector {
+    INPUT    = path '|fixtures/pointers',
+    doc_dir  = path '|tmp',
+  }
+
+  local lbinder = dub.LuaBinder()
+  lbinder:bind(ins, {
+    output_directory = tmp_path,
+    single_lib = 'lvbox',
+    only = {
+      'Vect',
+    },
+    index = 'lua',
+  })
+
+  local cpath_bak = package.cpath
+  assertPass(function()
+    lbinder:build {
+      output   = path '|tmp/lvbox.so',
+      inputs   = {
+        path '|tmp/dub/dub.cpp',
+        path '|tmp/lvbox_Vect.cpp',
+        path '|tmp/lvbox.cpp',
+        path '|fixtures/pointers/vect.cpp',
+      },
+      includes = {
+        path '|tmp',
+      },
+    }
+    package.cpath = tmp_path .. '/?.so'
+    lVect = require('lvbox').Vect
+  end, function()
+    -- teardown
+    package.cpath = cpath_bak
+  end)
+end
+
+function should.useLuaIndex()
+  local v = lVect(1.2, 3.4)
+  assertEqual(1.2, v.x)
+  v.y = 2
+  assertEqual(2, v.y)
+  assertEqual(2.4, v:surface())
+  assertEqual(1.2, v[1])
+  assertError("invalid key 'asdf'", function()
+    v.asdf = 15
+  end)
+  assertNil(v.asdf)
+  local o = setmetatable({super = v}, lVect)
+  assertEqual(1.2, o.x)
+  assertEqual(2.4, o:surface())
+end
+
+local function callMany(v)
+  local start = elapsed()
+  for i = 1,1000000 do
+    v:surface()
+  end
+  return elapsed() - start
+end
+
+local function readMany(v)
+  local start = elapsed()
+  for i = 1,1000000 do
+    local x = v.x
+  end
+  return elapsed() - start
+end
+
+--=============================================== Identity cache
+
+local iVect, iBox
+
+function should.bindCompileAndLoadWithIdentity()
+  local tmp_path = path '|tmp'
+  local ins = dub.Inspector {
+    INPUT    = path '|fixtures/pointers',
+    doc_dir  = path '|tmp',
+  }
+
+  local ibinder = dub.LuaBinder()
+  ibinder:bind(ins, {
+    output_directory = tmp_path,
+    single_lib = 'ibox',
+    only = {
+      'Box',
+      'Vect',
+    },
+    identity = true,
+  })
+
+  local cpath_bak = package.cpath
+  assertPass(function()
+    ibinder:build {
+      output   = path '|tmp/ibox.so',
+      inputs   = {
+        path '|tmp/dub/dub.cpp',
+        path '|tmp/ibox_Vect.cpp',
+        path '|tmp/ibox_Box.cpp',
+        path '|tmp/ibox.cpp',
+        path '|fixtures/pointers/vect.cpp',
+      },
+      includes = {
+        path '|tmp',
+      },
+    }
+    package.cpath = tmp_path .. '/?.so'
+    local ibox = require 'ibox'
+    iVect, iBox = ibox.Vect, ibox.Box
+  end, function()
+    -- teardown
+    package.cpath = cpath_bak
+  end)
+end
+
+function should.pushSameUserdataForSamePointer()
+  local b = iBox('box', iVect(1, 2))
+  local s = b:size()
+  assertTrue(rawequal(s, b:size()))
+  assertTrue(rawequal(s, b:sizeRef()))
+  assertEqual(2, s.y)
+  -- copies are not cached
+  assertFalse(rawequal(b:copySize(), b:copySize()))
+  s = nil
+  collectgarbage()
+  collectgarbage()
+  -- collected entry: new userdata
+  assertEqual(1, b:size().x)
+end
+
+local function sizeMany(b)
+  local start = elapsed()
+  for i = 1,1000000 do
+    local s = b:size()
+  end
+  return elapsed() - start
+end
+
+function should.compareIndexSpeed()
+  if test_speed then
+    local lens = require 'lens'
+    elapsed = lens.elapsed
+    -- warmup
+    callMany(Vect(1,2))
+    printf("C __index:   1'000'000 method calls:     %.2f ms.", callMany(Vect(1,2)))
+    printf("Lua __index: 1'000'000 method calls:     %.2f ms.", callMany(lVect(1,2)))
+    printf("C __index:   1'000'000 attribute reads:  %.2f ms.", readMany(Vect(1,2)))
+    printf("Lua __index: 1'000'000 attribute reads:  %.2f ms.", readMany(lVect(1,2)))
+  end
+end
+
+--=============================================== Inline storage
+
+local sVect
+
+function should.bindCompileAndLoadWithInlineStorage()
+  local tmp_path = path '|tmp'
+  local ins = dub.Inspector {
+    INPUT    = path '|fixtures/pointers',
+    doc_dir  = path '|tmp',
+  }
+
+  local sbinder = dub.LuaBinder()
+  sbinder:bind(ins, {
+    output_directory = tmp_path,
+    single_lib = 'svbox',
+    only = {
+      'Vect',
+    },
+    storage = 'inline',
+  })
+
+  local cpath_bak = package.cpath
+  assertPass(function()
+    sbinder:build {
+      output   = path '|tmp/svbox.so',
+      inputs   = {
+        path '|tmp/dub/dub.cpp',
+        path '|tmp/svbox_Vect.cpp',
+        path '|tmp/svbox.cpp',
+        path '|fixtures/pointers/vect.cpp',
+      },
+      includes = {
+        path '|tmp',
+      },
+    }
+    package.cpath = tmp_path .. '/?.so'
+    sVect = require('svbox').Vect
+  end, function()
+    -- teardown
+    package.cpath = cpath_bak
+  end)
+end
+
+function should.constructAndDestroyInPlace()
+  collectgarbage()
+  local t = sVect(1,1)
+  t.create_count = 0
+  t.copy_count = 0
+  t.destroy_count = 0
+
+  local v1, v2 = sVect(1,2), sVect(50,80)
+  assertEqual(2, t.create_count)
+  local v3 = v1 + v2
+  assertEqual(51, v3.x)
+  assertEqual(82, v3.y)
+  assertEqual(3, t.create_count)
+  assertEqual(0, t.copy_count)
+  assertEqual(0, t.destroy_count)
+  v3:__gc()
+  assertEqual(1, t.destroy_count)
+  v1, v2, v3 = nil, nil, nil
+  collectgarbage()
+  collectgarbage()
+  -- v3 not destroyed twice
+  assertEqual(3, t.create_count)
+  assertEqual(3, t.destroy_count)
+end
+
+local function createMany(Vect)
+  local start = elapsed()
+  for i = 1,1000000 do
+    local v = Vect(1,3)
+  end
+  collectgarbage()
+  return elapsed() - start
+end
+
+function should.compareInlineStorageSpeed()
+  if test_speed then
+    local lens = require 'lens'
+    elapsed = lens.elapsed
+    printf("Heap storage:   create and destroy 1'000'000 elements: %.2f ms.", createMany(Vect))
+    printf("Inline storage: create and destroy 1'000'000 elements: %.2f ms.", createMany(sVect))
+  end
+end
+
+function should.compareIdentitySpeed()
+  if test_speed then
+    local lens = require 'lens'
+    elapsed = lens.elapsed
+    printf("New userdata:   1'000'000 pointer returns: %.2f ms.", sizeMany(Box('box', Vect(1,2))))
+    printf("Identity cache: 1'000'000 pointer returns: %.2f ms.", sizeMany(iBox('box', iVect(1,2))))
+  end
+end
+
 should:test()
 
@@ -10,7 +10,7 @@ local lub = require 'lub'
 local lut = require 'lut'
 local should = lut.Test('dub.LuaBinder - simple', {coverage = false})
 
-local Simple, Map, SubMap, reg
+local Simple, Map, SubMap, reg, lazy
 
 local dub = require 'dub'
 local binder = dub.LuaBinder {L = 'Ls'} -- custom 'L' state name.
@@ -68,8 +68,10 @@ function should.bindDestructor()
   local dtor   = Simple:method('~Simple')
   local res = binder:bindClass(Simple)
   assertMatch('Simple__Simple', res)
+  -- The class type is always the first declared type.
+  assertMatch('{ "Simple" +, 1, 0x%x+, NULL, NULL },', res)
   local res = binder:functionBody(Simple, dtor)
-  assertMatch('DubUserdata %*userdata = [^\n]+"Simple"', res)
+  assertMatch('DubUserdata %*userdata = [^\n]+dub_types%[0%]', res)
   assertMatch('if %(userdata%->gc%)', res)
   assertMatch('Simple %*self = %(Simple %*%)userdata%->ptr;', res)
   assertMatch('delete self;', res)
@@ -86,6 +88,27 @@ function should.bindStatic()
   assertEqual('pi', binder:bindName(met))
 end
 
+function should.bindWithoutExceptions()
+  local Simple = ins:find('Simple')
+  local lean = dub.LuaBinder {exceptions = false}
+  local res = lean:bindClass(Simple)
+  assertNotMatch('try {', res)
+  assertNotMatch('luaL_checksdata', res)
+  assertMatch('Simple %*self = %(Simple %*%)dub::checksdata_n%(L, 1, dub_types%[0%]%);', res)
+  assertMatch('DubUserdata %*userdata = dub::checksdata_dn%(L, 1, dub_types%[0%]%);', res)
+  assertMatch('dub::issdata_n%(L, 2, ', res)
+  assertMatch('luaL_checknumber%(L, 2%)', res)
+end
+
+function should.bindWithLazyErrors()
+  local Simple = ins:find('Simple')
+  local lazy = dub.LuaBinder {lazy_errors = true}
+  local res = lazy:bindClass(Simple)
+  assertMatch('dub::pusherror%(L, "add", e%);', res)
+  assertMatch('dub::pusherror%(L, "add"%);', res)
+  assertNotMatch('lua_pushfstring%(L, "add: %%s"', res)
+end
+
 function should.buildGetSet()
   binder.custom_bindings = custom_bindings
   local Map = ins:find('Map')
@@ -138,7 +161,7 @@ function should.properlyBindStructParam()
   local Simple = ins:find('Simple')
   local met = Simple:method('showBuf')
   local res = binder:functionBody(Simple, met)
-  assertMatch('Simple::MyBuf %*buf = %*%(%(Simple::MyBuf %*%*%)', res)
+  assertMatch('Simple::MyBuf %*buf = %(%(Simple::MyBuf %*%)', res)
   assertMatch('self%->showBuf%(%*buf%)', res)
 end
 
@@ -146,7 +169,7 @@ function should.properlyBindClassByValue()
   local Simple = ins:find('Simple')
   local met = Simple:method('showSimple')
   local res = binder:functionBody(Simple, met)
-  assertMatch('Simple %*p = %*%(%(Simple %*%*%)', res)
+  assertMatch('Simple %*p = %(%(Simple %*%)', res)
   assertMatch('self%->showSimple%(%*p%)', res)
 end
 
@@ -306,6 +329,14 @@ function should.bindCompileAndLoad()
       'reg::Reg',
     },
   })
+  -- Errors raised as dub.Error objects.
+  dub.LuaBinder {lazy_errors = true}:bind(ins, {
+    output_directory = tmp_path,
+    single_lib = 'lazy',
+    only = {
+      'Simple',
+    },
+  })
   
   local cpath_bak = package.cpath
   local s
@@ -366,6 +397,20 @@ function should.bindCompileAndLoad()
         base .. '/fixtures/simple/include',
       },
     }
+    binder:build {
+      output   = base .. '/tmp/lazy.so',
+      inputs   = {
+        base .. '/tmp/dub/dub.cpp',
+        base .. '/tmp/lazy.cpp',
+        base .. '/tmp/lazy_Simple.cpp',
+      },
+      includes = {
+        base .. '/tmp',
+        -- This is for lua.h
+        base .. '/tmp/dub',
+        base .. '/fixtures/simple/include',
+      },
+    }
     package.cpath = base .. '/tmp/?.so'
     Simple = require 'Simple'
     assertType('table', Simple)
@@ -375,6 +420,8 @@ function should.bindCompileAndLoad()
     assertType('table', SubMap)
     reg = require 'reg'
     assertType('table', reg)
+    lazy = require 'lazy'
+    assertType('table', lazy)
   end, function()
     -- teardown
     package.cpath = cpath_bak
@@ -459,6 +506,23 @@ function should.properlyHandleErrorMessagesInOverloaded()
   end)
 end
 
+function should.raiseErrorObjectsWithLazyErrors()
+  local s = lazy.Simple(2.4)
+  local ok, err = pcall(function()
+    s:setValue('foo')
+  end)
+  assertFalse(ok)
+  assertEqual('userdata', type(err))
+  assertEqual('setValue', err.func)
+  assertEqual(2, err.narg)
+  assertEqual('number', err.type)
+  assertEqual('string', err.found)
+  assertEqual('expected number, found string', err.message)
+  assertMatch('lua_simple_test.lua:[0-9]+: setValue: expected number, found string', tostring(err))
+  -- The object is not changed.
+  assertEqual(2.4, s:value())
+end
+
 function should.useCustomGetSet()
   local m = Map()
   m.animal = 'Cat'
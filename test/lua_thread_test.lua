@@ -24,6 +24,7 @@ local ins = dub.Inspector {
 }
 
 local thread
+local elapsed = function() return 0 end
 
 --=============================================== Callback bindings
 
@@ -74,6 +75,7 @@ function should.bindCompileAndLoad()
         'test/tmp/dub',
         'test/fixtures/thread',
       },
+      flags = '-pthread',
     }
     package.cpath = tmp_path .. '/?.so'
     thread = require 'thread'
@@ -129,10 +131,9 @@ end
 function should.notCastDubTemplate()
   -- __newindex for simple (native) types
   local Callback = ins:find('Callback')
-  local met = Callback:method(Callback.CAST_NAME)
-  local res = binder:functionBody(Callback, met)
-  assertMatch('DUB_ASSERT_KEY%(key, "Foo"%)', res)
-  assertNotMatch('Thread', res)
+  local res = binder:bindClass(Callback)
+  assertMatch('static_cast<Foo %*>', res)
+  assertNotMatch('static_cast<[^>]*Thread', res)
 end
 --=============================================== Callback from C++
 
@@ -151,6 +152,114 @@ function should.callbackFromCpp()
   assertEqual('something', r)
 end
 
+function should.callbackFromCppWithRef()
+  local c = thread.Callback('Alan Watts')
+  local caller = thread.Caller(c)
+  -- no callback
+  assertPass(function()
+    caller:callMany('nothing', 1, true)
+  end)
+  local r
+  function c:callback(value)
+    r = value
+  end
+  caller:callMany('something', 1, true)
+  assertEqual('something', r)
+  -- reassign callback
+  c.callback = function(self, value)
+    r = 'new ' .. value
+  end
+  caller:callMany('something', 1, true)
+  assertEqual('new something', r)
+  c.callback = nil
+  r = nil
+  caller:callMany('something', 1, true)
+  assertNil(r)
+end
+
+function should.callbackQueuedFromCpp()
+  local c = thread.Callback('Alan Watts')
+  local caller = thread.Caller(c)
+  local r = {}
+  function c:callback(value)
+    table.insert(r, value)
+  end
+  caller:callQueued('something', 3)
+  assertValueEqual({'something', 'something', 'something'}, r)
+end
+
+function should.continueQueuedCallsAfterError()
+  local c = thread.Callback('Alan Watts')
+  local caller = thread.Caller(c)
+  local r = 0
+  local errors = {}
+  function c:callback(value)
+    r = r + 1
+    if r % 2 == 0 then
+      error('Failure '..r)
+    end
+  end
+  function c:error(msg)
+    table.insert(errors, msg)
+  end
+  caller:callQueued('something', 5)
+  assertEqual(5, r)
+  assertEqual(2, #errors)
+  assertMatch('lua_thread_test.lua:%d+: Failure 2', errors[1])
+  assertMatch('lua_thread_test.lua:%d+: Failure 4', errors[2])
+end
+
+function should.deliverMessagesPostedFromManyThreads()
+  local c = thread.Callback('Alan Watts')
+  local caller = thread.Caller(c)
+  local last = {}
+  local count = 0
+  local out_of_order = 0
+  function c:callback(id, i)
+    count = count + 1
+    if i ~= (last[id] or 0) + 1 then
+      out_of_order = out_of_order + 1
+    end
+    last[id] = i
+  end
+  assertEqual(16 * 10000, caller:postMany(16, 10000))
+  assertEqual(16 * 10000, count)
+  assertEqual(0, out_of_order)
+  for id = 1, 16 do
+    assertEqual(10000, last[id])
+  end
+end
+
+local function callMany(caller, use_ref)
+  local start = elapsed()
+  caller:callMany('x', 1000000, use_ref)
+  return elapsed() - start
+end
+
+local function callQueued(caller)
+  local start = elapsed()
+  for i = 1,100 do
+    caller:callQueued('x', 10000)
+  end
+  return elapsed() - start
+end
+
+function should.compareCallbackSpeed()
+  if test_speed then
+    local lens = require 'lens'
+    elapsed = lens.elapsed
+    local c = thread.Callback('Alan Watts')
+    local caller = thread.Caller(c)
+    function c:callback(value)
+    end
+    -- warmup
+    callMany(caller, false)
+    printf("Callback by name: 1'000'000 calls:   %.2f ms.", callMany(caller, false))
+    printf("Callback handle:  1'000'000 calls:   %.2f ms.", callMany(caller, true))
+    printf("Queued callbacks: 1'000'000 calls:   %.2f ms.", callQueued(caller))
+  end
+end
+
 --=============================================== Error handling
 
 function should.useSelfErrorHandler()